@@ -27,25 +27,153 @@ typedef uint32_t lwc_refcounter;
 	
 /**
  * The type of a hash value used in libwapcaplet.
+ *
+ * This is 64 bits wide if libwapcaplet, and everything using it, is
+ * built with LWC_HASH_64, and 32 bits wide otherwise.
  */
+#ifdef LWC_HASH_64
+typedef uint64_t lwc_hash;
+#else
 typedef uint32_t lwc_hash;
+#endif
+
+/**
+ * The number of user data slots in each string.
+ *
+ * This is zero, and strings have no slots, unless libwapcaplet and
+ * everything using it are built with LWC_USER_SLOTS defined.
+ */
+#ifndef LWC_USER_SLOTS
+#define LWC_USER_SLOTS 0
+#endif
+
+/**
+ * The parts of an interned string which change after it is interned.
+ *
+ * NOTE: The contents of this struct are considered *PRIVATE* and may
+ * change in future revisions.  Do not rely on them whatsoever.
+ */
+typedef struct lwc_string_state_s {
+        struct lwc_string_s **	prevptr;
+        struct lwc_string_s *	next;
+        lwc_refcounter	refcnt;
+        struct lwc_string_s *	insensitive;
+#ifdef LWC_WITH_THREADS
+        struct lwc_thread_s *	owner;
+        uint32_t		shared;
+        struct lwc_string_s *	queued;
+#endif
+#if LWC_USER_SLOTS > 0
+        void *			user[LWC_USER_SLOTS];
+#endif
+#ifdef LWC_WITH_RECORD
+        uint32_t		record_id;
+#endif
+} lwc_string_state;
 
 /**
  * An interned string.
  *
+ * With LWC_SPLIT_LAYOUT, the state of a string is kept apart from it, so
+ * that the pages holding strings are never written once the strings are
+ * interned and stay shared between processes forked after that.
+ *
  * NOTE: The contents of this struct are considered *PRIVATE* and may
  * change in future revisions.  Do not rely on them whatsoever.
  * They're only here at all so that the ref, unref and matches etc can
  * use them.
  */
 typedef struct lwc_string_s {
-        struct lwc_string_s **	prevptr;
-        struct lwc_string_s *	next;
+#ifdef LWC_SPLIT_LAYOUT
+        lwc_string_state *	state;
+#else
+        lwc_string_state	state;
+#endif
         size_t		len;
         lwc_hash	hash;
-        lwc_refcounter	refcnt;
-        struct lwc_string_s *	insensitive;
+        lwc_hash	chash;
 } lwc_string;
+
+/* The state of a string, wherever it is kept */
+#ifdef LWC_SPLIT_LAYOUT
+#define lwc__state(str) ((str)->state)
+#else
+#define lwc__state(str) (&(str)->state)
+#endif
+
+#ifdef LWC_WITH_THREADS
+/*
+ * With LWC_WITH_THREADS, reference counts are biased towards the thread
+ * which interned the string (its owner).  The owner counts its references
+ * in refcnt without atomic operations; every other thread counts in
+ * shared, atomically, in units of LWC__SHARED_ONE.  The low bits of
+ * shared are flags: MERGED once the owner has given up refcnt and every
+ * thread uses shared, QUEUED while the string is waiting for its owner
+ * to merge it because other threads have released more than they took.
+ */
+#define LWC__SHARED_QUEUED	(1u)
+#define LWC__SHARED_MERGED	(2u)
+#define LWC__SHARED_ONE		(4u)
+
+/*
+ * Strings in a segment shared between processes are never counted, as
+ * other processes are reading them.  Their owner is this, which is no
+ * thread, so every update to their counts can be skipped.
+ */
+#define LWC__OWNER_STATIC	((struct lwc_thread_s *)(uintptr_t)1)
+
+/** The calling thread's reference counting state. */
+extern __thread struct lwc_thread_s lwc__thread;
+
+extern void lwc__string_merge(struct lwc_string_s *str);
+extern void lwc__string_unref_shared(struct lwc_string_s *str);
+
+/* The caseless form of a string, which another thread may be setting */
+#define lwc__insensitive(str) \
+	__atomic_load_n(&lwc__state(str)->insensitive, __ATOMIC_ACQUIRE)
+#else
+#define lwc__insensitive(str) (lwc__state(str)->insensitive)
+
+/*
+ * Strings in a segment shared between processes are never counted, as
+ * other processes are reading them.  Their count is this, which no
+ * counted string reaches, so every update to it can be skipped.
+ */
+#define LWC__REFCNT_STATIC	(UINT32_MAX)
+#endif
+
+#if LWC_USER_SLOTS > 0 && defined(LWC_WITH_THREADS)
+#define lwc__user_data(str, slot) \
+	__atomic_load_n(&lwc__state(str)->user[(slot)], __ATOMIC_ACQUIRE)
+#elif LWC_USER_SLOTS > 0
+#define lwc__user_data(str, slot) (lwc__state(str)->user[(slot)])
+#else
+#define lwc__user_data(str, slot) ((void)(slot), (void *)NULL)
+#endif
+
+#ifdef LWC_WITH_RECORD
+/* Set while lwc_record_start() is recording calls */
+extern bool lwc__recording;
+
+extern void lwc__record_ref(struct lwc_string_s *str);
+extern void lwc__record_unref(struct lwc_string_s *str);
+extern void lwc__record_caseless(struct lwc_string_s *str1,
+				 struct lwc_string_s *str2);
+
+#ifdef LWC_WITH_THREADS
+#define lwc__is_recording() __atomic_load_n(&lwc__recording, __ATOMIC_RELAXED)
+#else
+#define lwc__is_recording() (lwc__recording)
+#endif
+
+/* Record a call, given without its lwc__record_ prefix */
+#define LWC__RECORD(call) do {						\
+		if (lwc__is_recording())				\
+			lwc__record_##call;				\
+	} while (0)
+#else
+#define LWC__RECORD(call) ((void)0)
+#endif
 	
 /**
  * String iteration function
@@ -61,9 +189,136 @@ typedef void (*lwc_iteration_callback_fn)(lwc_string *str, void *pw);
 typedef enum lwc_error_e {
 	lwc_error_ok		= 0,	/**< No error. */
 	lwc_error_oom		= 1,	/**< Out of memory. */
-	lwc_error_range		= 2	/**< Substring internment out of range. */
+	lwc_error_range		= 2,	/**< Substring internment out of range. */
+	lwc_error_unsupported	= 3,	/**< Not supported by this build. */
+	lwc_error_busy		= 4,	/**< Not possible while strings exist. */
+	lwc_error_invalid	= 5,	/**< Malformed input. */
+	lwc_error_unshared	= 6,	/**< Done, but in private memory. */
+	lwc_error_io		= 7	/**< Reading or writing failed. */
 } lwc_error;
 
+/**
+ * Memory allocation function
+ *
+ * @param size The number of bytes to allocate.
+ * @param pw   The private pointer for the allocator.
+ * @return     Pointer to the allocated memory, or NULL on failure.
+ */
+typedef void *(*lwc_alloc_fn)(size_t size, void *pw);
+
+/**
+ * Memory release function
+ *
+ * @param ptr The memory to release, as returned by the ::lwc_alloc_fn.
+ * @param pw  The private pointer for the allocator.
+ */
+typedef void (*lwc_free_fn)(void *ptr, void *pw);
+
+/**
+ * Sized memory release function
+ *
+ * @param ptr  The memory to release, as returned by the ::lwc_alloc_fn.
+ * @param size The size which was passed to the ::lwc_alloc_fn.
+ * @param pw   The private pointer for the allocator.
+ */
+typedef void (*lwc_sized_free_fn)(void *ptr, size_t size, void *pw);
+
+/**
+ * User data destructor function
+ *
+ * @param str  The string which is being destroyed.
+ * @param data The data attached to \a str, which is never NULL.
+ * @param pw   The private pointer for the destructor.
+ */
+typedef void (*lwc_user_data_destructor_fn)(lwc_string *str, void *data,
+		void *pw);
+
+/**
+ * Operations reported by the tracing hooks.
+ */
+typedef enum lwc_trace_op_e {
+	lwc_trace_intern_hit	  = 0,	/**< Interning found an existing string. */
+	lwc_trace_intern_miss	  = 1,	/**< Interning created a new string. */
+	lwc_trace_intern_caseless = 2,	/**< A caseless copy was interned. */
+	lwc_trace_destroy	  = 3,	/**< A string is about to be destroyed. */
+	lwc_trace_op_count	  = 4	/**< Number of traced operations. */
+} lwc_trace_op;
+
+/**
+ * Trace callback function
+ *
+ * @param op  The operation which was performed.
+ * @param str The string it was performed upon.
+ * @param pw  The private pointer for the callback.
+ */
+typedef void (*lwc_trace_callback_fn)(lwc_trace_op op, lwc_string *str,
+				      void *pw);
+
+/**
+ * Number of buckets in a latency histogram.
+ */
+#define LWC_TRACE_HISTOGRAM_SIZE (32)
+
+/**
+ * Calls timed by ::lwc_replay.
+ */
+typedef enum lwc_replay_op_e {
+	lwc_replay_intern	= 0,	/**< lwc_intern_string() */
+	lwc_replay_substring	= 1,	/**< lwc_intern_substring() */
+	lwc_replay_ref		= 2,	/**< lwc_string_ref() */
+	lwc_replay_unref	= 3,	/**< lwc_string_unref() */
+	lwc_replay_caseless	= 4,	/**< lwc_string_caseless_isequal() */
+	lwc_replay_tolower	= 5,	/**< lwc_string_tolower() */
+	lwc_replay_op_count	= 6	/**< Number of replayed calls. */
+} lwc_replay_op;
+
+/**
+ * Timings of one kind of call replayed by ::lwc_replay.
+ *
+ * Latencies are in nanoseconds, and percentiles are accurate to within
+ * an eighth.  Each call is timed on its own, so the cost of reading the
+ * clock is included.
+ */
+typedef struct lwc_replay_stats_s {
+	uint64_t	calls;		/**< Number of calls */
+	uint64_t	elapsed;	/**< Total time spent in them */
+	uint64_t	p50;		/**< Median latency */
+	uint64_t	p90;		/**< 90th percentile latency */
+	uint64_t	p99;		/**< 99th percentile latency */
+	uint64_t	max;		/**< Longest latency */
+} lwc_replay_stats;
+
+/**
+ * Number of entries filled out by ::lwc_replay: one for each
+ * ::lwc_replay_op and a last one for all calls together.
+ */
+#define LWC_REPLAY_STATS_SIZE (lwc_replay_op_count + 1)
+
+/**
+ * Set the memory allocator used by libwapcaplet.
+ *
+ * Every allocation libwapcaplet makes, including the context, its
+ * hash table and the strings themselves, goes through the allocator.
+ * By default that is malloc() and free().  The exception is the state
+ * ::lwc_replay keeps for itself, which always comes from malloc() so
+ * the allocator sees only what the replayed calls cost.
+ *
+ * @param alloc	     The allocation function, or NULL to restore the
+ *		     default allocator.
+ * @param free	     The release function.  May be NULL if \a sized_free
+ *		     is given.
+ * @param sized_free The release function taking the size of the memory,
+ *		     or NULL.  Used in preference to \a free if given.
+ * @param pw	     The private pointer to pass to the functions.
+ * @return lwc_error_ok on success, or lwc_error_busy if any strings are
+ *	   interned or calls are being recorded.
+ *
+ * @note With LWC_WITH_THREADS, this must not be called while other
+ *	 threads are using libwapcaplet.
+ */
+extern lwc_error lwc_set_allocator(lwc_alloc_fn alloc, lwc_free_fn free,
+				   lwc_sized_free_fn sized_free, void *pw);
+
 /**
  * Intern a string.
  *
@@ -106,9 +361,35 @@ extern lwc_error lwc_intern_substring(lwc_string *str,
                                       size_t ssoffset, size_t sslen,
                                       lwc_string **ret);
 
+/**
+ * Intern every token of delimited text.
+ *
+ * Splits text such as a class attribute or a selector list at any of a
+ * set of delimiter characters, and interns each token with the table
+ * locked once.  Runs of delimiters, and delimiters at either end, make
+ * no empty tokens.
+ *
+ * @param s	 Pointer to the start of the text.
+ * @param slen	 Length of the text in characters.
+ * @param delims The delimiter characters, NUL terminated.
+ * @param strs	 Filled out with a reference to each token, in order.
+ * @param count	 On entry, the number of entries in \a strs.  On exit,
+ *		 the number of tokens.
+ * @return lwc_error_ok on success, lwc_error_range if \a strs is too
+ *	   small, or lwc_error_oom on memory exhaustion.  On error, no
+ *	   references are held.
+ */
+extern lwc_error lwc_intern_split(const char *s, size_t slen,
+				  const char *delims,
+				  lwc_string **strs, size_t *count);
+
 /**
  * Optain a lowercased lwc_string from given lwc_string.
  *
+ * Only ASCII letters are lowercased, unless libwapcaplet is built with
+ * LWC_UNICODE_FOLD, in which case UTF-8 content is given its Unicode
+ * simple case folding, and the result may differ in length.
+ *
  * @param str  String to create lowercase string from.
  * @param ret  Pointer to ::lwc_string pointer to fill out.
  * @return     Result of operation, if not OK then the value pointed
@@ -133,14 +414,34 @@ extern lwc_error lwc_string_tolower(lwc_string *str, lwc_string **ret);
  * @note Use this if copying the string and intending both sides to retain
  * ownership.
  */
-#if defined(STMTEXPR)
-#define lwc_string_ref(str) ({lwc_string *__lwc_s = (str); assert(__lwc_s != NULL); __lwc_s->refcnt++; __lwc_s;})
+#if defined(LWC_WITH_THREADS)
+static inline lwc_string *
+lwc_string_ref(lwc_string *str)
+{
+	assert(str != NULL);
+	lwc_string_state *state = lwc__state(str);
+
+	struct lwc_thread_s *owner;
+
+	LWC__RECORD(ref(str));
+	owner = __atomic_load_n(&state->owner, __ATOMIC_RELAXED);
+	if (owner == &lwc__thread)
+		state->refcnt++;
+	else if (owner != LWC__OWNER_STATIC)
+		__atomic_fetch_add(&state->shared, LWC__SHARED_ONE,
+				   __ATOMIC_RELAXED);
+	return str;
+}
+#elif defined(STMTEXPR)
+#define lwc_string_ref(str) ({lwc_string *__lwc_s = (str); assert(__lwc_s != NULL); LWC__RECORD(ref(__lwc_s)); if (lwc__state(__lwc_s)->refcnt != LWC__REFCNT_STATIC) lwc__state(__lwc_s)->refcnt++; __lwc_s;})
 #else
 static inline lwc_string *
 lwc_string_ref(lwc_string *str)
 {
 	assert(str != NULL);
-	str->refcnt++;
+	LWC__RECORD(ref(str));
+	if (lwc__state(str)->refcnt != LWC__REFCNT_STATIC)
+		lwc__state(str)->refcnt++;
 	return str;
 }
 #endif
@@ -153,17 +454,43 @@ lwc_string_ref(lwc_string *str)
  * @param str The string to unref.
  *
  * @note If the reference count reaches zero then the string will be
- *       freed. (Ref count of 1 where string is its own insensitve match
- *       will also result in the string being freed.)
+ *       freed.  In deferred reclamation mode it is instead left for
+ *       ::lwc_collect, and in background mode it is removed from the
+ *       table but its memory is left for ::lwc_reclaim.
  */
+#if defined(LWC_WITH_THREADS)
+#define lwc_string_unref(str) {						\
+		lwc_string *__lwc_s = (str);				\
+		struct lwc_thread_s *__lwc_o;				\
+		assert(__lwc_s != NULL);				\
+		LWC__RECORD(unref(__lwc_s));				\
+		__lwc_o = __atomic_load_n(&lwc__state(__lwc_s)->owner,	\
+				__ATOMIC_RELAXED);			\
+		if (__lwc_o == &lwc__thread) {				\
+			if (--lwc__state(__lwc_s)->refcnt == 0)		\
+				lwc__string_merge(__lwc_s);		\
+		} else if (__lwc_o != LWC__OWNER_STATIC) {		\
+			lwc__string_unref_shared(__lwc_s);		\
+		}							\
+	}
+#elif defined(LWC_DEFERRED_RECLAIM)
 #define lwc_string_unref(str) {						\
 		lwc_string *__lwc_s = (str);				\
 		assert(__lwc_s != NULL);				\
-		__lwc_s->refcnt--;						\
-		if ((__lwc_s->refcnt == 0) ||					\
-		    ((__lwc_s->refcnt == 1) && (__lwc_s->insensitive == __lwc_s)))	\
+		LWC__RECORD(unref(__lwc_s));				\
+		if (lwc__state(__lwc_s)->refcnt != LWC__REFCNT_STATIC)	\
+			lwc__state(__lwc_s)->refcnt--;			\
+	}
+#else
+#define lwc_string_unref(str) {						\
+		lwc_string *__lwc_s = (str);				\
+		assert(__lwc_s != NULL);				\
+		LWC__RECORD(unref(__lwc_s));				\
+		if (lwc__state(__lwc_s)->refcnt != LWC__REFCNT_STATIC &&	\
+		    --lwc__state(__lwc_s)->refcnt == 0)			\
 			lwc_string_destroy(__lwc_s);				\
 	}
+#endif
 	
 /**
  * Destroy an unreffed lwc_string.
@@ -174,6 +501,130 @@ lwc_string_ref(lwc_string *str)
  */
 extern void lwc_string_destroy(lwc_string *str);
 
+/**
+ * Ways of reclaiming strings whose last reference is released.
+ */
+typedef enum lwc_reclaim_mode_e {
+	/** Free strings as soon as their last reference goes. */
+	lwc_reclaim_immediate	= 0,
+	/** Leave dead strings in place until ::lwc_collect is called.
+	 * Interning a dead string brings it back without reallocating it. */
+	lwc_reclaim_deferred	= 1,
+	/** Remove strings from the table as soon as their last reference
+	 * goes, but queue their memory to be freed by ::lwc_reclaim. */
+	lwc_reclaim_background	= 2
+} lwc_reclaim_mode;
+
+/**
+ * Select how strings are reclaimed.
+ *
+ * Switching to immediate or background reclamation collects any dead
+ * strings first, and switching away from background reclamation frees
+ * everything it has queued.
+ *
+ * If libwapcaplet, and the code using it, is built with
+ * LWC_DEFERRED_RECLAIM then reclamation is always deferred, and
+ * ::lwc_string_unref does nothing but decrement the reference count.
+ *
+ * With LWC_WITH_THREADS, the mode must not be changed while other
+ * threads are using libwapcaplet.
+ *
+ * @param mode The reclamation mode to use.
+ * @return lwc_error_ok on success, or lwc_error_unsupported if the mode
+ *	   is not available in this build.
+ */
+extern lwc_error lwc_set_reclaim_mode(lwc_reclaim_mode mode);
+
+/**
+ * Free every dead string.
+ *
+ * In deferred reclamation mode, strings whose last reference has been
+ * released stay interned until this is called, or until
+ * ::lwc_iterate_strings is.  In immediate mode there are never any dead
+ * strings to free.
+ *
+ * With LWC_WITH_THREADS, this also merges the reference counts of any
+ * strings the calling thread interned which other threads have released,
+ * which is otherwise done the next time the thread interns a string.
+ *
+ * @return The number of strings freed.
+ */
+extern size_t lwc_collect(void);
+
+/**
+ * Free strings queued by background reclamation.
+ *
+ * In background reclamation mode, releasing the last reference to a
+ * string only removes it from the table, so that threads which can't
+ * afford to wait for the allocator don't.  Its memory is freed, most
+ * recently queued first, when this is called: from an idle handler, or
+ * with LWC_WITH_THREADS from a thread of its own.  The table is locked
+ * for a few strings at a time, so interning carries on meanwhile.
+ *
+ * Nothing is queued in any other mode.
+ *
+ * @param budget The most strings to free; SIZE_MAX frees them all.
+ * @return The number of strings freed.
+ */
+extern size_t lwc_reclaim(size_t budget);
+
+/**
+ * Release a reference on each of an array of lwc_strings.
+ *
+ * This is equivalent to calling ::lwc_string_unref on every entry of
+ * the array, but is cheaper when releasing many strings at once, such
+ * as when tearing down a document.
+ *
+ * @param strs The strings to unref.  A string may appear more than once.
+ * @param n    The number of entries in \a strs.
+ *
+ * @note The contents of \a strs are undefined on return.
+ */
+extern void lwc_string_unref_many(lwc_string **strs, size_t n);
+
+/**
+ * Encode a set of strings as a string table.
+ *
+ * Each distinct string is written once, with its length and hashes, so
+ * that ::lwc_table_decode can intern the whole table again at once.
+ * Cached documents may then refer to their strings by table index.
+ *
+ * @param strs    The strings to encode.  A string may appear more than
+ *		  once.
+ * @param n	  The number of entries in \a strs.
+ * @param indices Filled out with the table index of each entry of
+ *		  \a strs, or NULL.
+ * @param buf     The buffer to encode into, or NULL.
+ * @param size    On entry, the size of \a buf.  On exit, the size of
+ *		  the table.
+ * @return lwc_error_ok on success, lwc_error_range if \a buf is NULL or
+ *	   too small, or lwc_error_oom on memory exhaustion.
+ */
+extern lwc_error lwc_table_encode(lwc_string *const *strs, size_t n,
+				  uint32_t *indices, void *buf, size_t *size);
+
+/**
+ * Intern every string in a table from ::lwc_table_encode.
+ *
+ * The table is interned with one lock.  Tables may come from any
+ * process.  Every string is hashed again as it is interned, rather
+ * than trusting the hashes stored in the table, so a table which has
+ * been altered can't intern a second copy of a string.
+ *
+ * @param buf   The table.
+ * @param size  The size of the table.
+ * @param strs  Filled out with a reference to each string in the table,
+ *		by index, or NULL.
+ * @param count On entry, the number of entries in \a strs.  On exit,
+ *		the number of strings in the table.
+ * @return lwc_error_ok on success, lwc_error_range if \a strs is NULL or
+ *	   too small, lwc_error_invalid if \a buf is not a table, or
+ *	   lwc_error_oom on memory exhaustion.  On error, no references
+ *	   are held.
+ */
+extern lwc_error lwc_table_decode(const void *buf, size_t size,
+				  lwc_string **strs, size_t *count);
+
 /**
  * Check if two interned strings are equal.
  *
@@ -200,6 +651,48 @@ extern void lwc_string_destroy(lwc_string *str);
 extern lwc_error
 lwc__intern_caseless_string(lwc_string *str);
 
+/**
+ * Compare the content of two strings without regard to case.  Unless
+ * built with LWC_UNICODE_FOLD, they must be the same length.
+ *
+ * @note This is for "internal" use by the caseless comparison
+ *       macro and not for users.
+ */
+extern bool
+lwc__string_caseless_compare(const lwc_string *str1, const lwc_string *str2);
+
+/**
+ * Decide whether two strings are caselessly equal.
+ *
+ * Their caseless hashes settle most comparisons, so their caseless forms
+ * are only looked at if both have been interned already, and never
+ * interned here.
+ */
+static inline bool
+lwc__string_caseless_match(lwc_string *str1, lwc_string *str2)
+{
+	lwc_string *insensitive1, *insensitive2;
+
+	if (str1 == str2)
+		return true;
+
+#ifdef LWC_UNICODE_FOLD
+	/* Strings of different lengths may fold to the same one */
+	if (str1->chash != str2->chash)
+		return false;
+#else
+	if (str1->chash != str2->chash || str1->len != str2->len)
+		return false;
+#endif
+
+	insensitive1 = lwc__insensitive(str1);
+	insensitive2 = lwc__insensitive(str2);
+	if (insensitive1 != NULL && insensitive2 != NULL)
+		return insensitive1 == insensitive2;
+
+	return lwc__string_caseless_compare(str1, str2);
+}
+
 #if defined(STMTEXPR)
 /**
  * Check if two interned strings are case-insensitively equal.
@@ -211,20 +704,13 @@ lwc__intern_caseless_string(lwc_string *str);
  *	    not be valid.
  */
 #define lwc_string_caseless_isequal(_str1,_str2,_ret) ({                \
-            lwc_error __lwc_err = lwc_error_ok;                         \
             lwc_string *__lwc_str1 = (_str1);                           \
             lwc_string *__lwc_str2 = (_str2);                           \
             bool *__lwc_ret = (_ret);                                   \
                                                                         \
-            if (__lwc_str1->insensitive == NULL) {                      \
-                __lwc_err = lwc__intern_caseless_string(__lwc_str1);    \
-            }                                                           \
-            if (__lwc_err == lwc_error_ok && __lwc_str2->insensitive == NULL) { \
-                __lwc_err = lwc__intern_caseless_string(__lwc_str2);    \
-            }                                                           \
-            if (__lwc_err == lwc_error_ok)                              \
-                *__lwc_ret = (__lwc_str1->insensitive == __lwc_str2->insensitive); \
-            __lwc_err;                                                  \
+            LWC__RECORD(caseless(__lwc_str1, __lwc_str2));              \
+            *__lwc_ret = lwc__string_caseless_match(__lwc_str1, __lwc_str2); \
+            lwc_error_ok;                                               \
         })
 	
 #else
@@ -240,16 +726,9 @@ lwc__intern_caseless_string(lwc_string *str);
 static inline lwc_error
 lwc_string_caseless_isequal(lwc_string *str1, lwc_string *str2, bool *ret)
 {
-       lwc_error err = lwc_error_ok;
-       if (str1->insensitive == NULL) {
-           err = lwc__intern_caseless_string(str1);
-       }
-       if (err == lwc_error_ok && str2->insensitive == NULL) {
-           err = lwc__intern_caseless_string(str2);
-       }
-       if (err == lwc_error_ok)
-           *ret = (str1->insensitive == str2->insensitive);
-       return err;
+       LWC__RECORD(caseless(str1, str2));
+       *ret = lwc__string_caseless_match(str1, str2);
+       return lwc_error_ok;
 }
 #endif
 
@@ -281,6 +760,18 @@ lwc_string_caseless_isequal(lwc_string *str1, lwc_string *str2, bool *ret)
  */
 #define lwc_string_length(str) lwc__assert_and_expr(str, (str)->len)
 
+/**
+ * Reduce a hash value to the 32 bits ::lwc_string_hash_value returns.
+ */
+static inline uint32_t lwc__hash_fold(lwc_hash hash)
+{
+#ifdef LWC_HASH_64
+	return (uint32_t)(hash ^ (hash >> 32));
+#else
+	return hash;
+#endif
+}
+
 /**
  * Retrieve (or compute if unavailable) a hash value for the content of the string.
  *
@@ -293,7 +784,85 @@ lwc_string_caseless_isequal(lwc_string *str1, lwc_string *str2, bool *ret)
  *	 to be stable between invocations of the program. Never use the hash
  *	 value as a way to directly identify the value of the string.
  */
-#define lwc_string_hash_value(str) lwc__assert_and_expr(str, (str)->hash)
+#define lwc_string_hash_value(str) \
+	lwc__assert_and_expr(str, lwc__hash_fold((str)->hash))
+
+/**
+ * Retrieve the full width hash value for the content of the string.
+ *
+ * @param str The string to get the hash for.
+ * @return    The ::lwc_hash of \a str.  In builds without LWC_HASH_64
+ *	      this is the same as ::lwc_string_hash_value.
+ *
+ * @note The same caveats apply as for ::lwc_string_hash_value.
+ */
+#define lwc_string_full_hash_value(str) \
+	lwc__assert_and_expr(str, (str)->hash)
+
+/**
+ * Retrieve the data attached to a string in a user data slot.
+ *
+ * @param str  The string to retrieve the data of.
+ * @param slot The slot, as returned by ::lwc_register_user_slot.
+ * @return     The data attached by ::lwc_string_set_user_data, or NULL
+ *	       if there is none.  Always NULL if libwapcaplet was built
+ *	       without LWC_USER_SLOTS.
+ */
+#define lwc_string_user_data(str, slot) \
+	lwc__assert_and_expr(str, lwc__user_data(str, slot))
+
+/**
+ * Register a user data slot.
+ *
+ * Each slot lets a consumer keep one pointer in every string, such as a
+ * parsed form of its content, one load away from the string itself
+ * rather than in a map keyed on it.  Slots are meant to be registered
+ * once, at startup, and can't be given back.
+ *
+ * @param destructor Function to call with the data in the slot of each
+ *		     string which is destroyed, or NULL for none.  It must
+ *		     not intern or release strings.
+ * @param pw	     The private word for \a destructor.
+ * @param slot	     Pointer to location to receive the slot.
+ * @return lwc_error_ok on success, lwc_error_range if every slot has
+ *	   been registered, or lwc_error_unsupported if libwapcaplet was
+ *	   built without LWC_USER_SLOTS.
+ */
+extern lwc_error lwc_register_user_slot(lwc_user_data_destructor_fn destructor,
+		void *pw, unsigned int *slot);
+
+/**
+ * Attach data to a string in a user data slot.
+ *
+ * Each slot of each string may be set once, so that threads racing to
+ * attach the same data agree on whose copy won: the loser is told
+ * the slot is busy and can fetch the winner's with
+ * ::lwc_string_user_data.  The data is passed to the slot's destructor
+ * when the string is destroyed.
+ *
+ * @param str  The string to attach data to.
+ * @param slot The slot, as returned by ::lwc_register_user_slot.
+ * @param data The data to attach, which must not be NULL.
+ * @return lwc_error_ok on success, lwc_error_busy if the slot already
+ *	   has data in it, lwc_error_range if \a slot isn't registered,
+ *	   lwc_error_invalid if \a str is in a shared segment, where data
+ *	   can't be attached, or lwc_error_unsupported if libwapcaplet was
+ *	   built without LWC_USER_SLOTS.
+ */
+extern lwc_error lwc_string_set_user_data(lwc_string *str, unsigned int slot,
+		void *data);
+
+/**
+ * Compute the hash value of a string without interning it.
+ *
+ * @param s    Pointer to the start of the string.
+ * @param slen Length of the string in characters.
+ * @return     The value ::lwc_string_full_hash_value gives for an
+ *	       interned string with the same content.
+ *
+ * @note The same caveats apply as for ::lwc_string_hash_value.
+ */
+extern lwc_hash lwc_calculate_hash(const char *s, size_t slen);
 
 /**
  * Retrieve a hash value for the caseless content of the string.
@@ -306,14 +875,8 @@ lwc_string_caseless_isequal(lwc_string *str1, lwc_string *str2, bool *ret)
 static inline lwc_error lwc_string_caseless_hash_value(
 	lwc_string *str, lwc_hash *hash)
 {
-	if (str->insensitive == NULL) {
-		lwc_error err = lwc__intern_caseless_string(str);
-		if (err != lwc_error_ok) {
-			return err;
-		}
-	}
-
-	*hash = str->insensitive->hash;
+	/* Kept in the string, so that its caseless form need not exist */
+	*hash = str->chash;
 	return lwc_error_ok;
 }
 
@@ -323,13 +886,201 @@ static inline lwc_error lwc_string_caseless_hash_value(
  *
  * If there are no strings found in the context, then this has the
  * side effect of removing the global context which will reduce the
- * chances of false-positives on leak checkers.
+ * chances of false-positives on leak checkers.  Any dead strings are
+ * collected first, as by ::lwc_collect.
  *
  * @param cb The callback to give the string to.
  * @param pw The private word for the callback.
+ *
+ * @note With LWC_WITH_THREADS, the callback is called with the table
+ *	 locked, so must not intern or release strings.
  */
 extern void lwc_iterate_strings(lwc_iteration_callback_fn cb, void *pw);
 
+/**
+ * Iterate the context and return every string starting with a prefix.
+ *
+ * The first call builds an index of the strings in the context which
+ * is then kept up to date as strings are interned and destroyed, so
+ * that later calls cost time proportional to the number of matches
+ * rather than the number of strings in the context.
+ *
+ * @param prefix The prefix to look for.
+ * @param plen	 The length of \a prefix in characters.  Zero matches
+ *		 every string.
+ * @param cb	 The callback to give the string to.
+ * @param pw	 The private word for the callback.
+ *
+ * @note The callback must not intern or release strings.
+ */
+extern void lwc_iterate_prefix(const char *prefix, size_t plen,
+			       lwc_iteration_callback_fn cb, void *pw);
+
+/**
+ * Register a callback for the tracing hooks.
+ *
+ * The callback is called for every interning hit and miss, every
+ * caseless interning, and every string destruction.  In addition one in
+ * every \a sample of those operations is timed, and its latency added to
+ * a per-operation histogram which can be read with ::lwc_trace_histogram.
+ * The interning a caseless interning does is reported, but timed only as
+ * part of the caseless interning.
+ *
+ * With LWC_WITH_THREADS, the callback may be called by several threads
+ * at once, as frozen strings are interned without taking a lock.
+ *
+ * @param cb	 The callback to call, or NULL for none.
+ * @param pw	 The private word for the callback.
+ * @param sample How often to time an operation, or zero to time none.
+ * @return lwc_error_ok on success, or lwc_error_unsupported if
+ *	   libwapcaplet was built without LWC_WITH_TRACE.
+ *
+ * @note The callback must not intern or release strings.
+ */
+extern lwc_error lwc_set_trace_callback(lwc_trace_callback_fn cb, void *pw,
+					unsigned int sample);
+
+/**
+ * Retrieve the latency histogram for a traced operation.
+ *
+ * Entry n of the histogram counts operations which took between 2^n
+ * and 2^(n+1) nanoseconds; the last entry also counts anything slower.
+ *
+ * @param op   The operation to retrieve the histogram of.
+ * @param hist The histogram to fill out.
+ * @return lwc_error_ok on success, or lwc_error_unsupported if
+ *	   libwapcaplet was built without LWC_WITH_TRACE.
+ */
+extern lwc_error lwc_trace_histogram(lwc_trace_op op,
+				     uint64_t hist[LWC_TRACE_HISTOGRAM_SIZE]);
+
+/**
+ * Publish every interned string to a shared segment.
+ *
+ * The segment is written to \a fd, which should refer to a shared memory
+ * object or file open for reading and writing, and may then be attached
+ * by other processes with ::lwc_shm_attach.  The caseless form of every
+ * string is interned before publishing, so the segment holds those too.
+ *
+ * The table stays locked while the segment is written, so other threads
+ * interning or releasing strings meanwhile wait; strings they intern
+ * before or after that are published or not, but never in part.
+ *
+ * @param fd The file descriptor to write the segment to.
+ * @return lwc_error_ok on success, lwc_error_oom if memory could not be
+ *	   allocated or the segment could not be written, or
+ *	   lwc_error_unsupported if libwapcaplet was built without
+ *	   LWC_WITH_SHM.
+ */
+extern lwc_error lwc_shm_publish(int fd);
+
+/**
+ * Attach a shared segment written by ::lwc_shm_publish.
+ *
+ * Interning any string in the segment returns the shared copy rather
+ * than allocating a private one, so processes attached to the same
+ * segment share its pages.  Shared strings are never destroyed, and
+ * references to them may be taken and released as usual, though they
+ * are not counted, so that no process writes to them.
+ *
+ * Every chain and record in the segment is checked to lie within it
+ * when it is attached.  Processes which can write to the segment after
+ * that are trusted not to.
+ *
+ * Strings in the segment link to each other by offset, so it may be
+ * mapped anywhere and is never written.  With LWC_SPLIT_LAYOUT, though,
+ * each string points at its state, so unless the segment can be mapped
+ * where its publisher had it, this process takes a private copy of it
+ * to correct those pointers, and lwc_error_unshared is returned.  The
+ * segment is attached all the same.
+ *
+ * The segment must be attached before any string is interned, as the
+ * publisher's hash seed is adopted, and only one segment may be attached.
+ *
+ * @param fd The file descriptor the segment was written to.
+ * @return lwc_error_ok on success, lwc_error_unshared if attached
+ *	   as a private copy, lwc_error_busy if any strings are
+ *	   interned or a segment is already attached, lwc_error_invalid if
+ *	   \a fd does not hold a segment this build can use,
+ *	   lwc_error_oom if it could not be mapped, or
+ *	   lwc_error_unsupported if libwapcaplet was built without
+ *	   LWC_WITH_SHM.
+ */
+extern lwc_error lwc_shm_attach(int fd);
+
+/**
+ * Freeze the strings interned so far.
+ *
+ * The strings interned when this is called, and their caseless forms,
+ * are moved into a read-only table indexed by a minimal perfect hash.
+ * Interning one of them again then takes one hash, one table lookup and
+ * one comparison, and never waits for the table lock.  Strings interned
+ * afterwards go into the ordinary table as before.
+ *
+ * Frozen strings are never destroyed, and references to them may be
+ * taken and released as usual.  This is meant for callers which intern
+ * a fixed vocabulary at startup, such as the names a parser recognises.
+ *
+ * @return lwc_error_ok on success, lwc_error_busy if the table has
+ *	   already been frozen, lwc_error_range if no perfect hash could
+ *	   be found for the strings or there are too many of them, or
+ *	   lwc_error_oom on memory exhaustion.  Nothing is frozen on
+ *	   error, and the strings stay interned as they were.
+ */
+extern lwc_error lwc_freeze(void);
+
+/**
+ * Start recording calls into libwapcaplet.
+ *
+ * Every call to ::lwc_intern_string, ::lwc_intern_substring,
+ * ::lwc_string_ref, ::lwc_string_unref (including through
+ * ::lwc_string_unref_many), ::lwc_string_caseless_isequal and
+ * ::lwc_string_tolower is logged to \a fd in a compact binary trace,
+ * which ::lwc_replay can run again later.  Strings interned before
+ * recording started are interned at the start of the replay, so traces
+ * may be taken from a process part way through its life.  Strings from
+ * a shared segment are left out.
+ *
+ * With LWC_WITH_THREADS, calls from every thread go into the one trace
+ * in the order they were made.
+ *
+ * @param fd The file descriptor to write the trace to.  It is not closed
+ *	     by ::lwc_record_stop.
+ * @return lwc_error_ok on success, lwc_error_busy if already recording,
+ *	   or lwc_error_unsupported if libwapcaplet was built without
+ *	   LWC_WITH_RECORD.
+ */
+extern lwc_error lwc_record_start(int fd);
+
+/**
+ * Stop recording calls, and write out the rest of the trace.
+ *
+ * @return lwc_error_ok on success, lwc_error_io if any of the trace
+ *	   could not be written, lwc_error_invalid if not recording, or
+ *	   lwc_error_unsupported if libwapcaplet was built without
+ *	   LWC_WITH_RECORD.
+ */
+extern lwc_error lwc_record_stop(void);
+
+/**
+ * Run the calls in a trace written by ::lwc_record_start again.
+ *
+ * Each call is made as it was recorded and timed.  Every reference the
+ * replay takes is released before returning, so afterwards the strings
+ * interned are as they were.  This works whether or not libwapcaplet
+ * was built with LWC_WITH_RECORD, so a trace may be replayed against
+ * any build.
+ *
+ * @param fd    The file descriptor to read the trace from.
+ * @param stats Filled out with timings for each kind of call, and
+ *		for all calls together.
+ * @return lwc_error_ok on success, lwc_error_invalid if \a fd does not
+ *	   hold a trace this version can read, or lwc_error_oom on memory
+ *	   exhaustion.
+ */
+extern lwc_error lwc_replay(int fd,
+			    lwc_replay_stats stats[LWC_REPLAY_STATS_SIZE]);
+
 #ifdef __cplusplus
 }
 #endif
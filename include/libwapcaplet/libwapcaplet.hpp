@@ -0,0 +1,302 @@
+/* libwapcaplet.hpp
+ *
+ * C++ interface to libwapcaplet.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_hpp_
+#define libwapcaplet_hpp_
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <string_view>
+#include <utility>
+
+#include <libwapcaplet/libwapcaplet.h>
+
+namespace lwc {
+
+/**
+ * An owning handle on an interned string.
+ *
+ * Copying a handle takes a reference on the string; moving one transfers
+ * the reference without touching the count.  Handles compare equal if
+ * and only if they refer to the same interned string.
+ */
+class string {
+public:
+	/**
+	 * Construct an empty handle.
+	 */
+	string() noexcept : m_str(nullptr) {}
+
+	/**
+	 * Intern a string.
+	 *
+	 * @param s The string to intern.
+	 * @throw std::bad_alloc if the string could not be interned.
+	 */
+	explicit string(std::string_view s) : m_str(nullptr)
+	{
+		if (lwc_intern_string(s.data(), s.size(), &m_str) !=
+				lwc_error_ok)
+			throw std::bad_alloc();
+	}
+
+	string(const string &other) noexcept : m_str(other.m_str)
+	{
+		if (m_str != nullptr)
+			lwc_string_ref(m_str);
+	}
+
+	string(string &&other) noexcept
+		: m_str(std::exchange(other.m_str, nullptr)) {}
+
+	~string()
+	{
+		if (m_str != nullptr)
+			lwc_string_unref(m_str);
+	}
+
+	string &operator=(const string &other) noexcept
+	{
+		string(other).swap(*this);
+		return *this;
+	}
+
+	string &operator=(string &&other) noexcept
+	{
+		string(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	/**
+	 * Take over a reference the caller already owns.
+	 *
+	 * @param str The string to take the reference on.
+	 */
+	static string adopt(lwc_string *str) noexcept
+	{
+		string ret;
+		ret.m_str = str;
+		return ret;
+	}
+
+	/**
+	 * Take a new reference on a string.
+	 *
+	 * @param str The string to take a reference on.
+	 */
+	static string share(lwc_string *str) noexcept
+	{
+		string ret;
+		if (str != nullptr)
+			ret.m_str = lwc_string_ref(str);
+		return ret;
+	}
+
+	/**
+	 * Give up the reference held by this handle to the caller.
+	 */
+	lwc_string *release() noexcept
+	{
+		return std::exchange(m_str, nullptr);
+	}
+
+	lwc_string *get() const noexcept { return m_str; }
+
+	explicit operator bool() const noexcept { return m_str != nullptr; }
+
+	const char *data() const noexcept
+	{
+		return lwc_string_data(m_str);
+	}
+
+	std::size_t size() const noexcept
+	{
+		return lwc_string_length(m_str);
+	}
+
+	bool empty() const noexcept { return size() == 0; }
+
+	std::string_view view() const noexcept
+	{
+		return std::string_view(data(), size());
+	}
+
+	/**
+	 * The hash of the string, as ::lwc_string_full_hash_value.
+	 */
+	lwc_hash hash() const noexcept
+	{
+		return lwc_string_full_hash_value(m_str);
+	}
+
+	/**
+	 * Compare two strings without regard to case.
+	 *
+	 * @throw std::bad_alloc if the comparison ran out of memory.
+	 */
+	bool caseless_equal(const string &other) const
+	{
+		bool result;
+
+		if (lwc_string_caseless_isequal(m_str, other.m_str,
+				&result) != lwc_error_ok)
+			throw std::bad_alloc();
+
+		return result;
+	}
+
+	void swap(string &other) noexcept
+	{
+		std::swap(m_str, other.m_str);
+	}
+
+	friend bool operator==(const string &a, const string &b) noexcept
+	{
+		return a.m_str == b.m_str;
+	}
+
+	friend bool operator!=(const string &a, const string &b) noexcept
+	{
+		return a.m_str != b.m_str;
+	}
+
+	friend bool operator==(const string &a, std::string_view b) noexcept
+	{
+		return a.m_str != nullptr && a.view() == b;
+	}
+
+	friend bool operator==(std::string_view a, const string &b) noexcept
+	{
+		return b == a;
+	}
+
+	friend bool operator!=(const string &a, std::string_view b) noexcept
+	{
+		return !(a == b);
+	}
+
+	friend bool operator!=(std::string_view a, const string &b) noexcept
+	{
+		return !(b == a);
+	}
+
+private:
+	lwc_string *m_str;
+};
+
+inline void swap(string &a, string &b) noexcept
+{
+	a.swap(b);
+}
+
+/**
+ * Hasher for unordered containers keyed on ::lwc::string.
+ *
+ * This supports heterogeneous lookup, so such containers may be searched
+ * with a std::string_view without interning it first.
+ */
+struct hash {
+	using is_transparent = void;
+
+	std::size_t operator()(const string &s) const noexcept
+	{
+		return s.hash();
+	}
+
+	std::size_t operator()(std::string_view s) const noexcept
+	{
+		return lwc_calculate_hash(s.data(), s.size());
+	}
+};
+
+/**
+ * Equality for unordered containers keyed on ::lwc::string.
+ */
+struct equal_to {
+	using is_transparent = void;
+
+	bool operator()(const string &a, const string &b) const noexcept
+	{
+		return a == b;
+	}
+
+	bool operator()(const string &a, std::string_view b) const noexcept
+	{
+		return a == b;
+	}
+
+	bool operator()(std::string_view a, const string &b) const noexcept
+	{
+		return b == a;
+	}
+};
+
+inline namespace literals {
+
+#if defined(__cpp_nontype_template_args) && \
+		(__cpp_nontype_template_args >= 201911L)
+
+namespace detail {
+
+template <std::size_t N>
+struct literal {
+	char chars[N];
+
+	constexpr literal(const char (&s)[N])
+	{
+		for (std::size_t i = 0; i < N; i++)
+			chars[i] = s[i];
+	}
+
+	constexpr std::string_view view() const
+	{
+		return std::string_view(chars, N - 1);
+	}
+};
+
+} /* namespace detail */
+
+/**
+ * Intern a string literal.
+ *
+ * Each distinct literal is interned once, on first use, and the handle
+ * kept for the life of the program, so later uses cost nothing.
+ *
+ * @verbatim
+ *   using namespace lwc::literals;
+ *   if (name == "div"_lwc) ...
+ * @endverbatim
+ *
+ * @throw std::bad_alloc if the string could not be interned.
+ */
+template <detail::literal L>
+inline const string &operator""_lwc()
+{
+	static const string s(L.view());
+	return s;
+}
+
+#endif
+
+} /* namespace literals */
+
+} /* namespace lwc */
+
+namespace std {
+
+template <>
+struct hash<lwc::string> {
+	std::size_t operator()(const lwc::string &s) const noexcept
+	{
+		return s.hash();
+	}
+};
+
+} /* namespace std */
+
+#endif /* libwapcaplet_hpp_ */
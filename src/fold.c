@@ -0,0 +1,338 @@
+/* fold.c
+ *
+ * Unicode simple case folding of UTF-8.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include "fold.h"
+
+#ifdef LWC_UNICODE_FOLD
+
+/* Added to a byte which isn't part of a character */
+#define FOLD_RAW	(0x110000)
+
+/*
+ * Runs of code points with a simple case folding: \a count code points
+ * from \a first, \a stride apart, each folding to itself plus \a delta.
+ * These are the C and S mappings of CaseFolding.txt from Unicode 14.0,
+ * apart from those of ASCII, sorted by first code point.
+ */
+typedef struct lwc_fold_run_s {
+	uint32_t	first;
+	uint8_t		count;
+	uint8_t		stride;
+	int32_t		delta;
+} lwc_fold_run;
+
+static const lwc_fold_run lwc__fold_runs[] = {
+	{ 0x000b5,   1, 1,    775 },
+	{ 0x000c0,  23, 1,     32 },
+	{ 0x000d8,   7, 1,     32 },
+	{ 0x00100,  24, 2,      1 },
+	{ 0x00132,   3, 2,      1 },
+	{ 0x00139,   8, 2,      1 },
+	{ 0x0014a,  23, 2,      1 },
+	{ 0x00178,   1, 1,   -121 },
+	{ 0x00179,   3, 2,      1 },
+	{ 0x0017f,   1, 1,   -268 },
+	{ 0x00181,   1, 1,    210 },
+	{ 0x00182,   2, 2,      1 },
+	{ 0x00186,   1, 1,    206 },
+	{ 0x00187,   1, 1,      1 },
+	{ 0x00189,   2, 1,    205 },
+	{ 0x0018b,   1, 1,      1 },
+	{ 0x0018e,   1, 1,     79 },
+	{ 0x0018f,   1, 1,    202 },
+	{ 0x00190,   1, 1,    203 },
+	{ 0x00191,   1, 1,      1 },
+	{ 0x00193,   1, 1,    205 },
+	{ 0x00194,   1, 1,    207 },
+	{ 0x00196,   1, 1,    211 },
+	{ 0x00197,   1, 1,    209 },
+	{ 0x00198,   1, 1,      1 },
+	{ 0x0019c,   1, 1,    211 },
+	{ 0x0019d,   1, 1,    213 },
+	{ 0x0019f,   1, 1,    214 },
+	{ 0x001a0,   3, 2,      1 },
+	{ 0x001a6,   1, 1,    218 },
+	{ 0x001a7,   1, 1,      1 },
+	{ 0x001a9,   1, 1,    218 },
+	{ 0x001ac,   1, 1,      1 },
+	{ 0x001ae,   1, 1,    218 },
+	{ 0x001af,   1, 1,      1 },
+	{ 0x001b1,   2, 1,    217 },
+	{ 0x001b3,   2, 2,      1 },
+	{ 0x001b7,   1, 1,    219 },
+	{ 0x001b8,   1, 1,      1 },
+	{ 0x001bc,   1, 1,      1 },
+	{ 0x001c4,   1, 1,      2 },
+	{ 0x001c5,   1, 1,      1 },
+	{ 0x001c7,   1, 1,      2 },
+	{ 0x001c8,   1, 1,      1 },
+	{ 0x001ca,   1, 1,      2 },
+	{ 0x001cb,   9, 2,      1 },
+	{ 0x001de,   9, 2,      1 },
+	{ 0x001f1,   1, 1,      2 },
+	{ 0x001f2,   2, 2,      1 },
+	{ 0x001f6,   1, 1,    -97 },
+	{ 0x001f7,   1, 1,    -56 },
+	{ 0x001f8,  20, 2,      1 },
+	{ 0x00220,   1, 1,   -130 },
+	{ 0x00222,   9, 2,      1 },
+	{ 0x0023a,   1, 1,  10795 },
+	{ 0x0023b,   1, 1,      1 },
+	{ 0x0023d,   1, 1,   -163 },
+	{ 0x0023e,   1, 1,  10792 },
+	{ 0x00241,   1, 1,      1 },
+	{ 0x00243,   1, 1,   -195 },
+	{ 0x00244,   1, 1,     69 },
+	{ 0x00245,   1, 1,     71 },
+	{ 0x00246,   5, 2,      1 },
+	{ 0x00345,   1, 1,    116 },
+	{ 0x00370,   2, 2,      1 },
+	{ 0x00376,   1, 1,      1 },
+	{ 0x0037f,   1, 1,    116 },
+	{ 0x00386,   1, 1,     38 },
+	{ 0x00388,   3, 1,     37 },
+	{ 0x0038c,   1, 1,     64 },
+	{ 0x0038e,   2, 1,     63 },
+	{ 0x00391,  17, 1,     32 },
+	{ 0x003a3,   9, 1,     32 },
+	{ 0x003c2,   1, 1,      1 },
+	{ 0x003cf,   1, 1,      8 },
+	{ 0x003d0,   1, 1,    -30 },
+	{ 0x003d1,   1, 1,    -25 },
+	{ 0x003d5,   1, 1,    -15 },
+	{ 0x003d6,   1, 1,    -22 },
+	{ 0x003d8,  12, 2,      1 },
+	{ 0x003f0,   1, 1,    -54 },
+	{ 0x003f1,   1, 1,    -48 },
+	{ 0x003f4,   1, 1,    -60 },
+	{ 0x003f5,   1, 1,    -64 },
+	{ 0x003f7,   1, 1,      1 },
+	{ 0x003f9,   1, 1,     -7 },
+	{ 0x003fa,   1, 1,      1 },
+	{ 0x003fd,   3, 1,   -130 },
+	{ 0x00400,  16, 1,     80 },
+	{ 0x00410,  32, 1,     32 },
+	{ 0x00460,  17, 2,      1 },
+	{ 0x0048a,  27, 2,      1 },
+	{ 0x004c0,   1, 1,     15 },
+	{ 0x004c1,   7, 2,      1 },
+	{ 0x004d0,  48, 2,      1 },
+	{ 0x00531,  38, 1,     48 },
+	{ 0x010a0,  38, 1,   7264 },
+	{ 0x010c7,   1, 1,   7264 },
+	{ 0x010cd,   1, 1,   7264 },
+	{ 0x013f8,   6, 1,     -8 },
+	{ 0x01c80,   1, 1,  -6222 },
+	{ 0x01c81,   1, 1,  -6221 },
+	{ 0x01c82,   1, 1,  -6212 },
+	{ 0x01c83,   2, 1,  -6210 },
+	{ 0x01c85,   1, 1,  -6211 },
+	{ 0x01c86,   1, 1,  -6204 },
+	{ 0x01c87,   1, 1,  -6180 },
+	{ 0x01c88,   1, 1,  35267 },
+	{ 0x01c90,  43, 1,  -3008 },
+	{ 0x01cbd,   3, 1,  -3008 },
+	{ 0x01e00,  75, 2,      1 },
+	{ 0x01e9b,   1, 1,    -58 },
+	{ 0x01e9e,   1, 1,  -7615 },
+	{ 0x01ea0,  48, 2,      1 },
+	{ 0x01f08,   8, 1,     -8 },
+	{ 0x01f18,   6, 1,     -8 },
+	{ 0x01f28,   8, 1,     -8 },
+	{ 0x01f38,   8, 1,     -8 },
+	{ 0x01f48,   6, 1,     -8 },
+	{ 0x01f59,   4, 2,     -8 },
+	{ 0x01f68,   8, 1,     -8 },
+	{ 0x01f88,   8, 1,     -8 },
+	{ 0x01f98,   8, 1,     -8 },
+	{ 0x01fa8,   8, 1,     -8 },
+	{ 0x01fb8,   2, 1,     -8 },
+	{ 0x01fba,   2, 1,    -74 },
+	{ 0x01fbc,   1, 1,     -9 },
+	{ 0x01fbe,   1, 1,  -7173 },
+	{ 0x01fc8,   4, 1,    -86 },
+	{ 0x01fcc,   1, 1,     -9 },
+	{ 0x01fd8,   2, 1,     -8 },
+	{ 0x01fda,   2, 1,   -100 },
+	{ 0x01fe8,   2, 1,     -8 },
+	{ 0x01fea,   2, 1,   -112 },
+	{ 0x01fec,   1, 1,     -7 },
+	{ 0x01ff8,   2, 1,   -128 },
+	{ 0x01ffa,   2, 1,   -126 },
+	{ 0x01ffc,   1, 1,     -9 },
+	{ 0x02126,   1, 1,  -7517 },
+	{ 0x0212a,   1, 1,  -8383 },
+	{ 0x0212b,   1, 1,  -8262 },
+	{ 0x02132,   1, 1,     28 },
+	{ 0x02160,  16, 1,     16 },
+	{ 0x02183,   1, 1,      1 },
+	{ 0x024b6,  26, 1,     26 },
+	{ 0x02c00,  48, 1,     48 },
+	{ 0x02c60,   1, 1,      1 },
+	{ 0x02c62,   1, 1, -10743 },
+	{ 0x02c63,   1, 1,  -3814 },
+	{ 0x02c64,   1, 1, -10727 },
+	{ 0x02c67,   3, 2,      1 },
+	{ 0x02c6d,   1, 1, -10780 },
+	{ 0x02c6e,   1, 1, -10749 },
+	{ 0x02c6f,   1, 1, -10783 },
+	{ 0x02c70,   1, 1, -10782 },
+	{ 0x02c72,   1, 1,      1 },
+	{ 0x02c75,   1, 1,      1 },
+	{ 0x02c7e,   2, 1, -10815 },
+	{ 0x02c80,  50, 2,      1 },
+	{ 0x02ceb,   2, 2,      1 },
+	{ 0x02cf2,   1, 1,      1 },
+	{ 0x0a640,  23, 2,      1 },
+	{ 0x0a680,  14, 2,      1 },
+	{ 0x0a722,   7, 2,      1 },
+	{ 0x0a732,  31, 2,      1 },
+	{ 0x0a779,   2, 2,      1 },
+	{ 0x0a77d,   1, 1, -35332 },
+	{ 0x0a77e,   5, 2,      1 },
+	{ 0x0a78b,   1, 1,      1 },
+	{ 0x0a78d,   1, 1, -42280 },
+	{ 0x0a790,   2, 2,      1 },
+	{ 0x0a796,  10, 2,      1 },
+	{ 0x0a7aa,   1, 1, -42308 },
+	{ 0x0a7ab,   1, 1, -42319 },
+	{ 0x0a7ac,   1, 1, -42315 },
+	{ 0x0a7ad,   1, 1, -42305 },
+	{ 0x0a7ae,   1, 1, -42308 },
+	{ 0x0a7b0,   1, 1, -42258 },
+	{ 0x0a7b1,   1, 1, -42282 },
+	{ 0x0a7b2,   1, 1, -42261 },
+	{ 0x0a7b3,   1, 1,    928 },
+	{ 0x0a7b4,   8, 2,      1 },
+	{ 0x0a7c4,   1, 1,    -48 },
+	{ 0x0a7c5,   1, 1, -42307 },
+	{ 0x0a7c6,   1, 1, -35384 },
+	{ 0x0a7c7,   2, 2,      1 },
+	{ 0x0a7d0,   1, 1,      1 },
+	{ 0x0a7d6,   2, 2,      1 },
+	{ 0x0a7f5,   1, 1,      1 },
+	{ 0x0ab70,  80, 1, -38864 },
+	{ 0x0ff21,  26, 1,     32 },
+	{ 0x10400,  40, 1,     40 },
+	{ 0x104b0,  36, 1,     40 },
+	{ 0x10570,  11, 1,     39 },
+	{ 0x1057c,  15, 1,     39 },
+	{ 0x1058c,   7, 1,     39 },
+	{ 0x10594,   2, 1,     39 },
+	{ 0x10c80,  51, 1,     64 },
+	{ 0x118a0,  32, 1,     32 },
+	{ 0x16e40,  32, 1,     32 },
+	{ 0x1e900,  34, 1,     34 },
+};
+
+#define FOLD_RUNS (sizeof(lwc__fold_runs) / sizeof(lwc__fold_runs[0]))
+
+static uint32_t
+lwc__fold_code_point(uint32_t c)
+{
+	size_t lo = 0, hi = FOLD_RUNS;
+
+	/* Find the last run starting at or before c */
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+
+		if (lwc__fold_runs[mid].first <= c)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (c >= lwc__fold_runs[lo].first) {
+		const lwc_fold_run *run = &lwc__fold_runs[lo];
+		uint32_t offset = c - run->first;
+
+		if (offset < (uint32_t)run->count * run->stride &&
+				offset % run->stride == 0)
+			return (uint32_t)((int32_t)c + run->delta);
+	}
+
+	return c;
+}
+
+uint32_t
+lwc__fold_next(const uint8_t **p, const uint8_t *end)
+{
+	const uint8_t *s = *p;
+	uint32_t c = s[0], min;
+	size_t n, i;
+
+	if (c < 0x80) {
+		*p = s + 1;
+		return (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+	} else if (c >= 0xc2 && c < 0xe0) {
+		n = 1;
+		c &= 0x1f;
+		min = 0x80;
+	} else if (c >= 0xe0 && c < 0xf0) {
+		n = 2;
+		c &= 0x0f;
+		min = 0x800;
+	} else if (c >= 0xf0 && c < 0xf5) {
+		n = 3;
+		c &= 0x07;
+		min = 0x10000;
+	} else {
+		*p = s + 1;
+		return FOLD_RAW + s[0];
+	}
+
+	if ((size_t)(end - s) <= n) {
+		*p = s + 1;
+		return FOLD_RAW + s[0];
+	}
+
+	for (i = 1; i <= n; i++) {
+		if ((s[i] & 0xc0) != 0x80) {
+			*p = s + 1;
+			return FOLD_RAW + s[0];
+		}
+		c = (c << 6) | (s[i] & 0x3f);
+	}
+
+	/* Overlong forms, surrogates and what lies beyond Unicode */
+	if (c < min || (c >= 0xd800 && c < 0xe000) || c >= 0x110000) {
+		*p = s + 1;
+		return FOLD_RAW + s[0];
+	}
+
+	*p = s + n + 1;
+
+	return lwc__fold_code_point(c);
+}
+
+size_t
+lwc__fold(const char *str, size_t len, char *buf)
+{
+	const uint8_t *p = (const uint8_t *)str, *end = p + len;
+	uint8_t *out = (uint8_t *)buf;
+
+	while (p < end)
+		out += lwc__fold_encode(lwc__fold_next(&p, end), out);
+
+	return out - (uint8_t *)buf;
+}
+
+bool
+lwc__fold_equal(const char *s1, size_t len1, const char *s2, size_t len2)
+{
+	const uint8_t *p1 = (const uint8_t *)s1, *end1 = p1 + len1;
+	const uint8_t *p2 = (const uint8_t *)s2, *end2 = p2 + len2;
+
+	while (p1 < end1 && p2 < end2) {
+		if (lwc__fold_next(&p1, end1) != lwc__fold_next(&p2, end2))
+			return false;
+	}
+
+	return (p1 == end1) && (p2 == end2);
+}
+
+#endif
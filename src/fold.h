@@ -0,0 +1,107 @@
+/* fold.h
+ *
+ * Unicode simple case folding of UTF-8.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_fold_h_
+#define libwapcaplet_fold_h_
+
+#include <string.h>
+
+#include "internal.h"
+
+#ifdef LWC_UNICODE_FOLD
+
+/* Folding a string can make it at most half as long again */
+#define LWC_FOLD_SPACE(len) ((len) + (len) / 2)
+
+/**
+ * Find out whether a string is all ASCII, a word at a time.
+ *
+ * ASCII strings fold exactly as lwc__dolower() folds them a byte at a
+ * time, so only other strings need to be folded a character at a time.
+ */
+static inline bool
+lwc__is_ascii(const char *str, size_t len)
+{
+	uint64_t any = 0, w;
+
+	for (; len >= 8; str += 8, len -= 8) {
+		memcpy(&w, str, sizeof(w));
+		any |= w;
+	}
+
+	for (; len > 0; len--)
+		any |= (uint8_t)*str++;
+
+	return (any & LWC_BYTES(0x80)) == 0;
+}
+
+/**
+ * Decode and fold the next character of a string.
+ *
+ * Bytes which don't start a well formed UTF-8 sequence are taken one at
+ * a time and left as they are.
+ *
+ * @param p   The position in the string, which is advanced.
+ * @param end The end of the string.
+ * @return The folded code point, or 0x110000 plus the value of a byte
+ *	   which isn't part of a character.
+ */
+uint32_t lwc__fold_next(const uint8_t **p, const uint8_t *end);
+
+/**
+ * Encode a value from ::lwc__fold_next as UTF-8.
+ *
+ * @return The number of bytes written to \a out, from one to four.
+ */
+static inline size_t
+lwc__fold_encode(uint32_t c, uint8_t out[4])
+{
+	if (c < 0x80) {
+		out[0] = (uint8_t)c;
+		return 1;
+	} else if (c < 0x800) {
+		out[0] = (uint8_t)(0xc0 | (c >> 6));
+		out[1] = (uint8_t)(0x80 | (c & 0x3f));
+		return 2;
+	} else if (c < 0x10000) {
+		out[0] = (uint8_t)(0xe0 | (c >> 12));
+		out[1] = (uint8_t)(0x80 | ((c >> 6) & 0x3f));
+		out[2] = (uint8_t)(0x80 | (c & 0x3f));
+		return 3;
+	} else if (c < 0x110000) {
+		out[0] = (uint8_t)(0xf0 | (c >> 18));
+		out[1] = (uint8_t)(0x80 | ((c >> 12) & 0x3f));
+		out[2] = (uint8_t)(0x80 | ((c >> 6) & 0x3f));
+		out[3] = (uint8_t)(0x80 | (c & 0x3f));
+		return 4;
+	}
+
+	out[0] = (uint8_t)c;
+	return 1;
+}
+
+/**
+ * Fold a string.
+ *
+ * @param str The string to fold.
+ * @param len The length of \a str.
+ * @param buf Filled out with the folded string, which needs at most
+ *	      LWC_FOLD_SPACE(len) bytes.
+ * @return The length of the folded string.
+ */
+size_t lwc__fold(const char *str, size_t len, char *buf);
+
+/**
+ * Compare the folded forms of two strings, without folding either into
+ * a buffer.
+ */
+bool lwc__fold_equal(const char *s1, size_t len1,
+		const char *s2, size_t len2);
+
+#endif
+
+#endif /* libwapcaplet_fold_h_ */
@@ -0,0 +1,262 @@
+/* frozen.c
+ *
+ * Frozen intern tables, found through a minimal perfect hash.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <string.h>
+
+#include "frozen.h"
+
+/* Average number of keys sharing a pilot */
+#define FROZEN_BUCKET_SIZE	(4)
+
+/* Seeds to try before giving up on finding a perfect hash */
+#define FROZEN_ATTEMPTS		(8)
+
+lwc_frozen *lwc__frozen = NULL;
+
+bool
+lwc__frozen_iterate(lwc_iteration_callback_fn cb, void *pw)
+{
+	const lwc_frozen *frozen = LWC_LOAD_ACQUIRE(&lwc__frozen);
+	uint32_t i;
+
+	if (frozen == NULL)
+		return false;
+
+	for (i = 0; i < frozen->count; i++)
+		cb(frozen->slots[i], pw);
+
+	return true;
+}
+
+/**** Building ****/
+
+/* A string and its key under the seed being tried */
+typedef struct lwc_frozen_key_s {
+	uint64_t	key;
+	lwc_string *	str;
+} lwc_frozen_key;
+
+/* A bucket, for ordering them largest first */
+typedef struct lwc_frozen_bucket_s {
+	uint32_t	size;
+	uint32_t	index;
+} lwc_frozen_bucket;
+
+/* Scratch space for building a table */
+typedef struct lwc_frozen_build_s {
+	lwc_frozen_key *	keys;		/**< Keys, grouped by bucket */
+	uint32_t *		start;		/**< First key of each bucket */
+	lwc_frozen_bucket *	order;		/**< Buckets, largest first */
+	uint8_t *		taken;		/**< Which slots are in use */
+} lwc_frozen_build;
+
+static int
+lwc__frozen_hash_cmp(const void *a, const void *b)
+{
+	lwc_hash ha = (*(lwc_string * const *)a)->hash;
+	lwc_hash hb = (*(lwc_string * const *)b)->hash;
+
+	return (ha > hb) - (ha < hb);
+}
+
+static int
+lwc__frozen_bucket_cmp(const void *a, const void *b)
+{
+	const lwc_frozen_bucket *ba = a, *bb = b;
+
+	if (ba->size != bb->size)
+		return (ba->size < bb->size) - (ba->size > bb->size);
+
+	return (ba->index > bb->index) - (ba->index < bb->index);
+}
+
+static void
+lwc__frozen_release(lwc_frozen_build *b, const lwc_frozen *frozen)
+{
+	if (b->keys != NULL)
+		LWC_FREE(b->keys, sizeof(lwc_frozen_key) * frozen->count);
+	if (b->start != NULL)
+		LWC_FREE(b->start, sizeof(uint32_t) *
+				(frozen->bucketcount + 1));
+	if (b->order != NULL)
+		LWC_FREE(b->order, sizeof(lwc_frozen_bucket) *
+				frozen->bucketcount);
+	if (b->taken != NULL)
+		LWC_FREE(b->taken, frozen->count);
+}
+
+static void
+lwc__frozen_destroy(lwc_frozen *frozen)
+{
+	if (frozen->slots != NULL)
+		LWC_FREE(frozen->slots, sizeof(lwc_string *) * frozen->count);
+	if (frozen->pilots != NULL)
+		LWC_FREE(frozen->pilots, sizeof(uint32_t) *
+				frozen->bucketcount);
+	LWC_FREE(frozen, sizeof(lwc_frozen));
+}
+
+/**
+ * Try to find pilots for every bucket under the table's current seed.
+ *
+ * @return true on success, false if some bucket couldn't be placed.
+ */
+static bool
+lwc__frozen_try(lwc_frozen *frozen, lwc_frozen_build *b,
+		lwc_string **strs)
+{
+	/* Once most slots are taken a lone key needs about count tries,
+	 * so this only gives up on a seed which is truly unlucky. */
+	uint32_t limit = 64 * frozen->count + 1024;
+	uint32_t i, j, n;
+
+	memset(b->start, 0, sizeof(uint32_t) * (frozen->bucketcount + 1));
+	memset(b->taken, 0, frozen->count);
+
+	/* Group the keys by bucket */
+	for (i = 0; i < frozen->count; i++) {
+		uint64_t key = lwc__frozen_mix((uint64_t)strs[i]->hash ^
+				frozen->seed);
+
+		b->start[LWC_FROZEN_RANGE(key >> 32, frozen->bucketcount) + 1]++;
+	}
+
+	for (n = 0; n < frozen->bucketcount; n++) {
+		b->order[n].size = b->start[n + 1];
+		b->order[n].index = n;
+		b->start[n + 1] += b->start[n];
+	}
+
+	for (i = 0; i < frozen->count; i++) {
+		uint64_t key = lwc__frozen_mix((uint64_t)strs[i]->hash ^
+				frozen->seed);
+		uint32_t bucket = LWC_FROZEN_RANGE(key >> 32,
+				frozen->bucketcount);
+		/* start[bucket] is the next free key of the bucket for now,
+		 * and the end of it by the time we're done */
+		lwc_frozen_key *k = &b->keys[b->start[bucket]++];
+
+		k->key = key;
+		k->str = strs[i];
+	}
+
+	for (n = frozen->bucketcount; n > 0; n--)
+		b->start[n] = b->start[n - 1];
+	b->start[0] = 0;
+
+	/* Big buckets are hardest to place, so place them while there is
+	 * still plenty of room */
+	qsort(b->order, frozen->bucketcount, sizeof(lwc_frozen_bucket),
+			lwc__frozen_bucket_cmp);
+
+	for (n = 0; n < frozen->bucketcount && b->order[n].size > 0; n++) {
+		uint32_t bucket = b->order[n].index;
+		lwc_frozen_key *keys = &b->keys[b->start[bucket]];
+		uint32_t size = b->order[n].size;
+		uint32_t pilot;
+
+		for (pilot = 0; pilot < limit; pilot++) {
+			for (j = 0; j < size; j++) {
+				uint32_t slot = lwc__frozen_slot(frozen,
+						keys[j].key, pilot);
+
+				if (b->taken[slot])
+					break;
+				b->taken[slot] = 1;
+			}
+
+			if (j == size)
+				break;
+
+			/* Give back the slots this pilot took */
+			while (j-- > 0)
+				b->taken[lwc__frozen_slot(frozen,
+						keys[j].key, pilot)] = 0;
+		}
+
+		if (pilot == limit)
+			return false;
+
+		frozen->pilots[bucket] = pilot;
+		for (j = 0; j < size; j++)
+			frozen->slots[lwc__frozen_slot(frozen, keys[j].key,
+					pilot)] = keys[j].str;
+	}
+
+	return true;
+}
+
+lwc_error
+lwc__frozen_build(lwc_string **strs, size_t n, lwc_frozen **ret)
+{
+	lwc_frozen_build b;
+	lwc_frozen *frozen;
+	size_t i, unique = 0;
+	int attempt;
+
+	assert((strs != NULL) || (n == 0));
+	assert(ret);
+
+	*ret = NULL;
+
+	/* Keep only the strings whose hash is theirs alone */
+	qsort(strs, n, sizeof(lwc_string *), lwc__frozen_hash_cmp);
+	for (i = 0; i < n; i++) {
+		if ((i > 0 && strs[i - 1]->hash == strs[i]->hash) ||
+				(i + 1 < n && strs[i + 1]->hash == strs[i]->hash))
+			continue;
+		strs[unique++] = strs[i];
+	}
+
+	if (unique == 0)
+		return lwc_error_ok;
+
+	/* Pilots have to count up to the search limit */
+	if (unique > (UINT32_MAX - 1024) / 64)
+		return lwc_error_range;
+
+	frozen = LWC_ALLOC(sizeof(lwc_frozen));
+	if (frozen == NULL)
+		return lwc_error_oom;
+
+	frozen->count = (uint32_t)unique;
+	frozen->bucketcount = frozen->count / FROZEN_BUCKET_SIZE + 1;
+	frozen->slots = LWC_ALLOC(sizeof(lwc_string *) * frozen->count);
+	frozen->pilots = LWC_ALLOC(sizeof(uint32_t) * frozen->bucketcount);
+
+	b.keys = LWC_ALLOC(sizeof(lwc_frozen_key) * frozen->count);
+	b.start = LWC_ALLOC(sizeof(uint32_t) * (frozen->bucketcount + 1));
+	b.order = LWC_ALLOC(sizeof(lwc_frozen_bucket) * frozen->bucketcount);
+	b.taken = LWC_ALLOC(frozen->count);
+
+	if (frozen->slots == NULL || frozen->pilots == NULL ||
+			b.keys == NULL || b.start == NULL ||
+			b.order == NULL || b.taken == NULL) {
+		lwc__frozen_release(&b, frozen);
+		lwc__frozen_destroy(frozen);
+		return lwc_error_oom;
+	}
+
+	/* The seed comes from the secret key, so nobody can pick strings
+	 * which defeat every one we try */
+	for (attempt = 0; attempt < FROZEN_ATTEMPTS; attempt++) {
+		frozen->seed = lwc__frozen_mix(lwc__key[0] + attempt);
+		if (lwc__frozen_try(frozen, &b, strs))
+			break;
+	}
+
+	lwc__frozen_release(&b, frozen);
+
+	if (attempt == FROZEN_ATTEMPTS) {
+		lwc__frozen_destroy(frozen);
+		return lwc_error_range;
+	}
+
+	*ret = frozen;
+
+	return lwc_error_ok;
+}
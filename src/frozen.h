@@ -0,0 +1,111 @@
+/* frozen.h
+ *
+ * Frozen intern tables, found through a minimal perfect hash.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_frozen_h_
+#define libwapcaplet_frozen_h_
+
+#include "internal.h"
+
+/**
+ * A frozen table.
+ *
+ * Keys are spread over buckets of about four, and each bucket has a
+ * pilot chosen so that its keys land in distinct slots.  Every string in
+ * the table has a slot of its own and there are no empty slots, so any
+ * hash leads to exactly one string, which is the only one it can be.
+ *
+ * A table is never changed or freed once it is built, so it may be read
+ * without any locking at all.
+ */
+typedef struct lwc_frozen_s {
+	lwc_string **	slots;		/**< One string per slot */
+	uint32_t *	pilots;		/**< Displacement for each bucket */
+	uint32_t	count;		/**< Number of slots */
+	uint32_t	bucketcount;	/**< Number of buckets */
+	uint64_t	seed;		/**< Mixed into every key */
+} lwc_frozen;
+
+/**
+ * Reference count added to frozen strings, far enough from zero that
+ * releasing more references than were taken can never bring it there.
+ */
+#define LWC_REFCNT_IMMORTAL	(0x10000000u)
+
+/* The frozen table, if lwc_freeze() has built one */
+extern lwc_frozen *lwc__frozen;
+
+/**
+ * The 64 bit finaliser from MurmurHash3.
+ */
+static inline uint64_t
+lwc__frozen_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+
+	return x;
+}
+
+/* Scale 32 random bits into [0, n) without a division */
+#define LWC_FROZEN_RANGE(x, n) \
+	((uint32_t)(((uint64_t)(uint32_t)(x) * (n)) >> 32))
+
+static inline uint32_t
+lwc__frozen_slot(const lwc_frozen *frozen, uint64_t key, uint32_t pilot)
+{
+	return LWC_FROZEN_RANGE(lwc__frozen_mix(key ^
+			(pilot * 0x9e3779b97f4a7c15ULL)), frozen->count);
+}
+
+/**
+ * Find the only string in a frozen table which can have a given hash.
+ *
+ * @param frozen The table to look in.
+ * @param h	 The hash to look for.
+ * @return The string in the slot for \a h, which the caller must compare
+ *	   with what it is looking for.
+ */
+static inline lwc_string *
+lwc__frozen_find(const lwc_frozen *frozen, lwc_hash h)
+{
+	uint64_t key = lwc__frozen_mix((uint64_t)h ^ frozen->seed);
+	uint32_t bucket = LWC_FROZEN_RANGE(key >> 32, frozen->bucketcount);
+
+	return frozen->slots[lwc__frozen_slot(frozen, key,
+			frozen->pilots[bucket])];
+}
+
+/**
+ * Build a frozen table.
+ *
+ * Strings which share their hash with another can't be told apart by
+ * a perfect hash, so they are left out.  A string is in the new table
+ * if and only if ::lwc__frozen_find gives it back for its own hash.
+ *
+ * @param strs The strings to consider.  The array is reordered.
+ * @param n    The number of strings in \a strs.
+ * @param ret  Pointer to location to receive the table, or NULL if there
+ *	       is nothing to put in one.
+ * @return lwc_error_ok on success, lwc_error_range if there are too many
+ *	   strings or no perfect hash could be found for them, or
+ *	   lwc_error_oom on memory exhaustion.
+ */
+lwc_error lwc__frozen_build(lwc_string **strs, size_t n, lwc_frozen **ret);
+
+/**
+ * Call a callback for every string in the frozen table, if any.
+ *
+ * @param cb The callback to give each string to.
+ * @param pw The private word for the callback.
+ * @return true if there were any strings, false otherwise.
+ */
+bool lwc__frozen_iterate(lwc_iteration_callback_fn cb, void *pw);
+
+#endif /* libwapcaplet_frozen_h_ */
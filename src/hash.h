@@ -0,0 +1,151 @@
+/* hash.h
+ *
+ * Hashing strings, shared by everything that interns them.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_hash_h_
+#define libwapcaplet_hash_h_
+
+#include <string.h>
+
+#include "internal.h"
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+static inline char
+lwc__dolower(const char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c + 'a' - 'A';
+	return c;
+}
+
+/* FNV-1a parameters for the width of lwc_hash */
+#ifdef LWC_HASH_64
+#define FNV_OFFSET_BASIS	UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME		UINT64_C(0x00000100000001b3)
+#else
+#define FNV_OFFSET_BASIS	(0x811c9dc5)
+#define FNV_PRIME		(0x01000193)
+#endif
+
+static inline lwc_hash
+lwc__fnv_hash(const char *str, size_t len)
+{
+	lwc_hash z = FNV_OFFSET_BASIS ^ lwc__seed;
+
+	while (len > 0) {
+		z *= FNV_PRIME;
+		z ^= *str++;
+		len--;
+	}
+
+	return z;
+}
+
+/**
+ * Calculate the hashes of a string and of its caseless form in one pass.
+ */
+static inline void
+lwc__fnv_hashes(const char *str, size_t len,
+		lwc_hash *hash, lwc_hash *chash)
+{
+	lwc_hash z = FNV_OFFSET_BASIS ^ lwc__seed;
+	lwc_hash c = z;
+
+	while (len > 0) {
+		z *= FNV_PRIME;
+		c *= FNV_PRIME;
+		z ^= *str;
+		c ^= lwc__dolower(*str++);
+		len--;
+	}
+
+	*hash = z;
+	*chash = c;
+}
+
+/**** Short strings ****/
+
+/* Strings up to this long are hashed and compared a word at a time */
+#define LWC_SHORT_MAX		(16)
+
+static inline uint64_t
+lwc__load64(const unsigned char *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, sizeof(w));
+
+	return w;
+}
+
+static inline uint64_t
+lwc__load32(const unsigned char *p)
+{
+	uint32_t w;
+
+	memcpy(&w, p, sizeof(w));
+
+	return w;
+}
+
+/**
+ * Load the content of a short string into two words.
+ *
+ * Strings of four bytes or more are covered by two overlapping loads and
+ * shorter ones by picking out their bytes, so nothing beyond the string
+ * is read and two strings of the same length have the same words exactly
+ * when they have the same content.
+ */
+static inline void
+lwc__short_words(const char *str, size_t len, uint64_t word[2])
+{
+	const unsigned char *p = (const unsigned char *)str;
+
+	if (len >= 8) {
+		word[0] = lwc__load64(p);
+		word[1] = lwc__load64(p + len - 8);
+	} else if (len >= 4) {
+		word[0] = lwc__load32(p) | (lwc__load32(p + len - 4) << 32);
+		word[1] = 0;
+	} else if (len > 0) {
+		word[0] = p[0] | (p[len / 2] << 8) | (p[len - 1] << 16);
+		word[1] = 0;
+	} else {
+		word[0] = word[1] = 0;
+	}
+}
+
+/**
+ * Lower case every byte of a word, as lwc__dolower() does for one.
+ */
+static inline uint64_t
+lwc__word_lower(uint64_t w)
+{
+	uint64_t low = w & LWC_BYTES(0x7f);
+	uint64_t ge_A = low + LWC_BYTES(0x80 - 'A');
+	uint64_t gt_Z = low + LWC_BYTES(0x80 - 'Z' - 1);
+	uint64_t upper = ~w & (ge_A ^ gt_Z) & LWC_BYTES(0x80);
+
+	return w | (upper >> 2);
+}
+
+/**
+ * Hash the words of a short string with a couple of multiplies.
+ */
+static inline lwc_hash
+lwc__short_hash(const uint64_t word[2], size_t len)
+{
+	uint64_t z;
+
+	z = (word[0] ^ lwc__key[0] ^ (len * 0x9e3779b97f4a7c15ULL)) *
+			0xbf58476d1ce4e5b9ULL;
+	z = (ROTL64(z, 29) ^ word[1] ^ lwc__key[1]) * 0x94d049bb133111ebULL;
+
+	return (lwc_hash)(z ^ (z >> 31));
+}
+
+#endif /* libwapcaplet_hash_h_ */
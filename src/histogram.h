@@ -0,0 +1,87 @@
+/* histogram.h
+ *
+ * Latency histograms, shared by lwc_replay() and the scaling test.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_histogram_h_
+#define libwapcaplet_histogram_h_
+
+#include <stdint.h>
+
+/* Latencies below this are counted exactly */
+#define LWC_HISTOGRAM_EXACT	(16)
+
+/* Buckets per power of two above that */
+#define LWC_HISTOGRAM_SPLIT	(8)
+
+#define LWC_HISTOGRAM_BUCKETS \
+	(LWC_HISTOGRAM_EXACT + (64 - 4) * LWC_HISTOGRAM_SPLIT)
+
+/**
+ * Find the bucket a latency is counted in.
+ */
+static inline unsigned int
+lwc__histogram_bucket(uint64_t ns)
+{
+	unsigned int bits = 4;
+
+	if (ns < LWC_HISTOGRAM_EXACT)
+		return (unsigned int)ns;
+
+	while ((ns >> bits) > 1)
+		bits++;
+
+	return LWC_HISTOGRAM_EXACT + (bits - 4) * LWC_HISTOGRAM_SPLIT +
+			((ns >> (bits - 3)) & (LWC_HISTOGRAM_SPLIT - 1));
+}
+
+/* The longest latency counted in a bucket */
+static inline uint64_t
+lwc__histogram_bucket_max(unsigned int bucket)
+{
+	unsigned int bits, split;
+
+	if (bucket < LWC_HISTOGRAM_EXACT)
+		return bucket;
+
+	bits = (bucket - LWC_HISTOGRAM_EXACT) / LWC_HISTOGRAM_SPLIT + 4;
+	split = (bucket - LWC_HISTOGRAM_EXACT) % LWC_HISTOGRAM_SPLIT;
+
+	return ((uint64_t)(LWC_HISTOGRAM_SPLIT + split + 1) <<
+			(bits - 3)) - 1;
+}
+
+/**
+ * Find a percentile of the latencies in a histogram, to within an eighth.
+ *
+ * @param hist    The histogram, of ::LWC_HISTOGRAM_BUCKETS buckets.
+ * @param max     The longest latency counted, which no percentile exceeds.
+ * @param percent The percentile wanted.
+ * @return The percentile, or 0 if nothing was counted.
+ */
+static inline uint64_t
+lwc__histogram_percentile(const uint64_t *hist, uint64_t max,
+			  unsigned int percent)
+{
+	uint64_t calls = 0, wanted, seen = 0;
+	unsigned int bucket;
+
+	for (bucket = 0; bucket < LWC_HISTOGRAM_BUCKETS; bucket++)
+		calls += hist[bucket];
+
+	wanted = (calls * percent + 99) / 100;
+	for (bucket = 0; bucket < LWC_HISTOGRAM_BUCKETS; bucket++) {
+		seen += hist[bucket];
+		if (seen >= wanted && seen > 0) {
+			uint64_t ns = lwc__histogram_bucket_max(bucket);
+
+			return (ns < max) ? ns : max;
+		}
+	}
+
+	return 0;
+}
+
+#endif /* libwapcaplet_histogram_h_ */
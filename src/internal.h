@@ -0,0 +1,173 @@
+/* internal.h
+ *
+ * Definitions shared between the parts of libwapcaplet.
+ *
+ * Copyright 2009 The NetSurf Browser Project.
+ *		  Daniel Silverstone <dsilvers@netsurf-browser.org>
+ */
+
+#ifndef libwapcaplet_internal_h_
+#define libwapcaplet_internal_h_
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "libwapcaplet/libwapcaplet.h"
+
+#ifndef UNUSED
+#define UNUSED(x) ((x) = (x))
+#endif
+
+#define STR_OF(str) ((char *)(str + 1))
+#define CSTR_OF(str) ((const char *)(str + 1))
+#define STATE_OF(str) lwc__state(str)
+
+/* A word with every byte set to b */
+#define LWC_BYTES(b)		(0x0101010101010101ULL * (b))
+
+/**
+ * Find the zero bytes of a word.
+ *
+ * @return A word with the top bit of each byte set if that byte of
+ *	   \a w is zero, and nothing else set.
+ */
+static inline uint64_t
+lwc__word_zeros(uint64_t w)
+{
+	return ~(((w & LWC_BYTES(0x7f)) + LWC_BYTES(0x7f)) | w |
+			LWC_BYTES(0x7f));
+}
+
+#if defined(__GNUC__) && ((__GNUC__ > 3) || \
+		((__GNUC__ == 3) && (__GNUC_MINOR__ >= 1)))
+#define LWC_PREFETCH(p) __builtin_prefetch((p), 1)
+#else
+#define LWC_PREFETCH(p) ((void)0)
+#endif
+
+#ifdef LWC_WITH_THREADS
+#define LWC_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define LWC_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define LWC_ADD_RELAXED(p, v) __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+
+/* Signed count of references in a shared word */
+#define LWC_SHARED_COUNT(w) ((int32_t)((w) & ~(LWC__SHARED_ONE - 1)) / \
+			     (int32_t)LWC__SHARED_ONE)
+
+/**
+ * Reference counting state for a thread.
+ */
+struct lwc_thread_s {
+	lwc_string *	queue;		/**< Strings for us to merge */
+	bool		registered;	/**< Exit handler installed */
+};
+#else
+#define LWC_LOAD_ACQUIRE(p) (*(p))
+#define LWC_STORE_RELEASE(p, v) (*(p) = (v))
+#define LWC_ADD_RELAXED(p, v) (*(p) += (v))
+#endif
+
+/* Per-process hash seed and key, see lwc__initialise_seed() */
+extern bool lwc__seeded;
+extern lwc_hash lwc__seed;
+extern uint64_t lwc__key[2];
+
+/**
+ * Find out whether a string has lost every reference held on it.
+ *
+ * With threads, only a string whose owner has merged its count can be
+ * seen to be dead; until then, it is taken to be live.
+ */
+static inline bool
+lwc__string_dead(const lwc_string *str)
+{
+#ifdef LWC_WITH_THREADS
+	return (LWC_LOAD_ACQUIRE(&STATE_OF(str)->owner) == NULL) &&
+		(LWC_LOAD_ACQUIRE(&STATE_OF(str)->shared) == LWC__SHARED_MERGED);
+#else
+	return STATE_OF(str)->refcnt == 0;
+#endif
+}
+
+/**
+ * Find out whether a string's count is never changed, as it is in a
+ * segment shared between processes.
+ */
+static inline bool
+lwc__string_static(const lwc_string *str)
+{
+#ifdef LWC_WITH_THREADS
+	return __atomic_load_n(&STATE_OF(str)->owner, __ATOMIC_RELAXED) ==
+			LWC__OWNER_STATIC;
+#else
+	return STATE_OF(str)->refcnt == LWC__REFCNT_STATIC;
+#endif
+}
+
+/**
+ * Find out whether any live strings are interned in the private table.
+ *
+ * Any dead strings awaiting collection are freed first.
+ */
+bool lwc__has_strings(void);
+
+typedef lwc_error (*lwc_every_fn)(lwc_string **strs, size_t n, void *pw);
+
+/**
+ * Call a function with every live string, the table locked throughout.
+ *
+ * The caseless form of every string, and those of the caseless forms,
+ * are interned first, so the strings given are closed under caseless
+ * interning.  None of them come or go until the function returns.  It
+ * must not intern or release strings.
+ *
+ * @param fn The function to give the strings to.
+ * @param pw The private word for \a fn.
+ * @return What \a fn returned, or lwc_error_oom.
+ */
+lwc_error lwc__with_every_string(lwc_every_fn fn, void *pw);
+
+/**
+ * The allocator in use, as set by ::lwc_set_allocator.
+ */
+typedef struct lwc_allocator_s {
+	lwc_alloc_fn		alloc;
+	lwc_free_fn		free;
+	lwc_sized_free_fn	sized_free;
+	void *			pw;
+} lwc_allocator;
+
+extern lwc_allocator lwc__allocator;
+
+static inline void *
+lwc__alloc(size_t size)
+{
+	return lwc__allocator.alloc(size, lwc__allocator.pw);
+}
+
+static inline void
+lwc__free(void *ptr, size_t size)
+{
+	if (lwc__allocator.sized_free != NULL)
+		lwc__allocator.sized_free(ptr, size, lwc__allocator.pw);
+	else
+		lwc__allocator.free(ptr, lwc__allocator.pw);
+}
+
+#define LWC_ALLOC(s) lwc__alloc(s)
+#define LWC_FREE(p, s) lwc__free((p), (s))
+
+/**
+ * Read a monotonic clock, in nanoseconds.
+ */
+static inline uint64_t
+lwc__now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif /* libwapcaplet_internal_h_ */
@@ -6,287 +6,2010 @@
  *		  Daniel Silverstone <dsilvers@netsurf-browser.org>
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#ifdef LWC_WITH_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "libwapcaplet/libwapcaplet.h"
 
-#ifndef UNUSED
-#define UNUSED(x) ((x) = (x))
+#include "internal.h"
+#include "fold.h"
+#include "frozen.h"
+#include "hash.h"
+#include "prefix.h"
+#include "record.h"
+#include "shm.h"
+#include "table.h"
+#include "trace.h"
+
+bool lwc__seeded = false;
+lwc_hash lwc__seed;
+uint64_t lwc__key[2];
+
+#define NR_BUCKETS_DEFAULT	(4091)
+
+/* Chain walks longer than this (plus a margin for the average load of
+ * the table) are taken as a sign of hostile input.  Tests may lower it
+ * to have every table switch to keyed buckets early.
+ */
+#ifndef LWC_CHAIN_LIMIT
+#define LWC_CHAIN_LIMIT	(32)
+#endif
+
+#ifdef LWC_SPLIT_LAYOUT
+/* Number of string states allocated at once */
+#define STATE_BLOCK_SIZE	(256)
+
+/* A string state, or a link in the list of free ones */
+typedef union lwc_state_slot_u {
+	lwc_string_state	state;
+	union lwc_state_slot_u *	free;
+} lwc_state_slot;
+
+/**
+ * A block of string states.
+ *
+ * States are packed into blocks of their own, so that reference counting
+ * and chain maintenance write to these pages and never to the strings.
+ */
+typedef struct lwc_state_block_s {
+	struct lwc_state_block_s *	next;
+	lwc_state_slot			slots[STATE_BLOCK_SIZE];
+} lwc_state_block;
+#endif
+
+typedef struct lwc_context_s {
+	lwc_string **		buckets;
+	lwc_hash		bucketcount;
+	size_t			count;
+	bool			keyed;
+	lwc_prefix_node *	prefixes;
+#ifdef LWC_SPLIT_LAYOUT
+	lwc_state_block *	state_blocks;
+	lwc_state_slot *	free_states;
+#endif
+	lwc_string *		dying;		/**< Queued for lwc_reclaim() */
+} lwc_context;
+
+static lwc_context *ctx = NULL;
+
+#if LWC_USER_SLOTS > 0
+/* Registered user data slots and their destructors */
+static unsigned int lwc__user_slots = 0;
+static lwc_user_data_destructor_fn lwc__user_destructor[LWC_USER_SLOTS];
+static void *lwc__user_pw[LWC_USER_SLOTS];
+#endif
+
+#ifdef LWC_DEFERRED_RECLAIM
+static lwc_reclaim_mode lwc__reclaim = lwc_reclaim_deferred;
+#else
+static lwc_reclaim_mode lwc__reclaim = lwc_reclaim_immediate;
+#endif
+
+#ifdef LWC_WITH_THREADS
+/* Everything but reference counting happens with this held */
+static pthread_mutex_t lwc__lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t lwc__once = PTHREAD_ONCE_INIT;
+static pthread_key_t lwc__exit_key;
+
+__thread struct lwc_thread_s lwc__thread;
+
+#define LWC_LOCK() pthread_mutex_lock(&lwc__lock)
+#define LWC_UNLOCK() pthread_mutex_unlock(&lwc__lock)
+#else
+#define LWC_LOCK() ((void)0)
+#define LWC_UNLOCK() ((void)0)
+#endif
+
+static void *
+lwc__default_alloc(size_t size, void *pw)
+{
+	UNUSED(pw);
+
+	return malloc(size);
+}
+
+static void
+lwc__default_free(void *ptr, void *pw)
+{
+	UNUSED(pw);
+
+	free(ptr);
+}
+
+lwc_allocator lwc__allocator = {
+	lwc__default_alloc,
+	lwc__default_free,
+	NULL,
+	NULL
+};
+
+typedef uint64_t (*lwc_keyed_hasher)(const char *, size_t);
+typedef int (*lwc_strncmp)(const char *, const char *, size_t);
+typedef void * (*lwc_memcpy)(void * restrict, const void * restrict, size_t);
+
+/**** Keyed hashing ****/
+
+#define SIPROUND do {							\
+		v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0;		\
+		v0 = ROTL64(v0, 32);					\
+		v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;		\
+		v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;		\
+		v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2;		\
+		v2 = ROTL64(v2, 32);					\
+	} while (0)
+
+/**
+ * SipHash-1-3 of a string, keyed with the per-process key.
+ *
+ * This is much slower than the FNV hash used for ::lwc_string.hash, so
+ * it is only used to pick buckets once a table has seen chains long
+ * enough to suggest that someone is feeding it collisions.
+ */
+static inline uint64_t
+lwc__siphash(const char *str, size_t len, bool lower)
+{
+	uint64_t v0 = 0x736f6d6570736575ULL ^ lwc__key[0];
+	uint64_t v1 = 0x646f72616e646f6dULL ^ lwc__key[1];
+	uint64_t v2 = 0x6c7967656e657261ULL ^ lwc__key[0];
+	uint64_t v3 = 0x7465646279746573ULL ^ lwc__key[1];
+	uint64_t b = ((uint64_t)len) << 56;
+	uint64_t m;
+	size_t i;
+
+	while (len >= 8) {
+		m = 0;
+		for (i = 0; i < 8; i++) {
+			char c = lower ? lwc__dolower(str[i]) : str[i];
+			m |= ((uint64_t)(unsigned char)c) << (8 * i);
+		}
+		v3 ^= m;
+		SIPROUND;
+		v0 ^= m;
+		str += 8;
+		len -= 8;
+	}
+
+	for (i = 0; i < len; i++) {
+		char c = lower ? lwc__dolower(str[i]) : str[i];
+		b |= ((uint64_t)(unsigned char)c) << (8 * i);
+	}
+
+	v3 ^= b;
+	SIPROUND;
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static uint64_t
+lwc__keyed_hash(const char *str, size_t len)
+{
+	return lwc__siphash(str, len, false);
+}
+
+static uint64_t
+lwc__keyed_lcase_hash(const char *str, size_t len)
+{
+	return lwc__siphash(str, len, true);
+}
+
+static inline uint64_t
+lwc__splitmix(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+static inline lwc_hash
+lwc__calculate_hash(const char *str, size_t len)
+{
+	uint64_t word[2];
+
+	if (len > LWC_SHORT_MAX)
+		return lwc__fnv_hash(str, len);
+
+	lwc__short_words(str, len, word);
+
+	return lwc__short_hash(word, len);
+}
+
+#ifdef LWC_UNICODE_FOLD
+/**
+ * Hash the folded form of a string as lwc__calculate_hash() would hash
+ * it, without folding it into a buffer.
+ */
+static lwc_hash
+lwc__fold_hash(const char *str, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)str, *end = p + len;
+	lwc_hash z = FNV_OFFSET_BASIS ^ lwc__seed;
+	char head[LWC_SHORT_MAX];
+	uint64_t word[2];
+	size_t folded = 0, i, j, n;
+
+	while (p < end) {
+		uint8_t bytes[4];
+
+		n = lwc__fold_encode(lwc__fold_next(&p, end), bytes);
+
+		for (i = 0; i < n; i++, folded++) {
+			/* Short strings are hashed by their words, so keep
+			 * the start until we know which this will be */
+			if (folded < LWC_SHORT_MAX) {
+				head[folded] = (char)bytes[i];
+				continue;
+			} else if (folded == LWC_SHORT_MAX) {
+				for (j = 0; j < LWC_SHORT_MAX; j++) {
+					z *= FNV_PRIME;
+					z ^= head[j];
+				}
+			}
+
+			z *= FNV_PRIME;
+			z ^= (char)bytes[i];
+		}
+	}
+
+	if (folded > LWC_SHORT_MAX)
+		return z;
+
+	lwc__short_words(head, folded, word);
+
+	return lwc__short_hash(word, folded);
+}
+#endif
+
+/**
+ * Calculate the hashes of a string and of its caseless form.
+ *
+ * @param word Filled out with the words of the string if it is short.
+ */
+static inline void
+lwc__calculate_hashes(const char *str, size_t len, uint64_t word[2],
+		      lwc_hash *hash, lwc_hash *chash)
+{
+	uint64_t lower[2];
+
+	if (len > LWC_SHORT_MAX) {
+		lwc__fnv_hashes(str, len, hash, chash);
+#ifdef LWC_UNICODE_FOLD
+		if (lwc__is_ascii(str, len) == false)
+			*chash = lwc__fold_hash(str, len);
+#endif
+		return;
+	}
+
+	lwc__short_words(str, len, word);
+	*hash = lwc__short_hash(word, len);
+
+#ifdef LWC_UNICODE_FOLD
+	/* The words hold every byte of the string */
+	if (((word[0] | word[1]) & LWC_BYTES(0x80)) != 0) {
+		*chash = lwc__fold_hash(str, len);
+		return;
+	}
+#endif
+
+	lower[0] = lwc__word_lower(word[0]);
+	lower[1] = lwc__word_lower(word[1]);
+	*chash = lwc__short_hash(lower, len);
+}
+
+/**
+ * Find out whether a string of the right length has the content sought.
+ *
+ * Short strings are compared by their words, which for a caseless
+ * lookup are those of the lower case content.
+ */
+static inline bool
+lwc__matches(const lwc_string *str, const char *s, size_t slen,
+	     const uint64_t word[2], lwc_strncmp compare)
+{
+	uint64_t w[2];
+
+	if (slen > LWC_SHORT_MAX)
+		return compare(CSTR_OF(str), s, slen) == 0;
+
+	lwc__short_words(CSTR_OF(str), slen, w);
+
+	return (w[0] == word[0]) && (w[1] == word[1]);
+}
+
+/**
+ * Pick the per-process hash seed and SipHash key.
+ *
+ * System entropy is used where there is any; otherwise we make do with
+ * the time and whatever address space layout randomisation gives us.
+ * The seed is chosen once and survives the context being discarded, so
+ * hash values stay stable for the life of the process.
+ */
+static void
+lwc__initialise_seed(void)
+{
+	uint64_t entropy[3] = { 0, 0, 0 };
+	uint64_t state;
+	FILE *fh;
+
+	fh = fopen("/dev/urandom", "rb");
+	if (fh != NULL) {
+		if (fread(entropy, sizeof(entropy), 1, fh) != 1)
+			memset(entropy, 0, sizeof(entropy));
+		fclose(fh);
+	}
+
+	state = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32) ^
+		(uint64_t)(uintptr_t)&state ^
+		((uint64_t)(uintptr_t)&lwc__seed << 16);
+
+	lwc__key[0] = lwc__splitmix(&state) ^ entropy[0];
+	lwc__key[1] = lwc__splitmix(&state) ^ entropy[1];
+	lwc__seed = (lwc_hash)(lwc__splitmix(&state) ^ entropy[2]);
+	LWC_STORE_RELEASE(&lwc__seeded, true);
+}
+
+/**** Chains and string state ****/
+
+/**
+ * Add a string to the head of a bucket's chain.
+ */
+static inline void
+lwc__chain_link(lwc_string *str, lwc_hash bucket)
+{
+	lwc_string_state *state = STATE_OF(str);
+
+	state->prevptr = &(ctx->buckets[bucket]);
+	state->next = ctx->buckets[bucket];
+	if (state->next != NULL)
+		STATE_OF(state->next)->prevptr = &(state->next);
+	ctx->buckets[bucket] = str;
+}
+
+/**
+ * Remove a string from its chain.
+ */
+static inline void
+lwc__chain_unlink(lwc_string *str)
+{
+	lwc_string_state *state = STATE_OF(str);
+
+	*(state->prevptr) = state->next;
+	if (state->next != NULL)
+		STATE_OF(state->next)->prevptr = state->prevptr;
+}
+
+#ifdef LWC_SPLIT_LAYOUT
+
+/**
+ * Allocate the state for a new string.
+ *
+ * @return The state, or NULL on memory exhaustion.
+ */
+static lwc_string_state *
+lwc__state_alloc(void)
+{
+	lwc_state_slot *slot = ctx->free_states;
+
+	if (slot == NULL) {
+		lwc_state_block *block = LWC_ALLOC(sizeof(lwc_state_block));
+		size_t i;
+
+		if (block == NULL)
+			return NULL;
+
+		block->next = ctx->state_blocks;
+		ctx->state_blocks = block;
+
+		for (i = STATE_BLOCK_SIZE; i > 0; i--) {
+			block->slots[i - 1].free = slot;
+			slot = &block->slots[i - 1];
+		}
+	}
+
+	ctx->free_states = slot->free;
+
+	return &slot->state;
+}
+
+static void
+lwc__state_free(lwc_string_state *state)
+{
+	lwc_state_slot *slot = (lwc_state_slot *)(void *)state;
+
+	slot->free = ctx->free_states;
+	ctx->free_states = slot;
+}
+
+#endif
+
+/**
+ * Rethread every string in the context by its keyed hash.
+ */
+static void
+lwc__rekey(void)
+{
+	lwc_string *all = NULL, *str, *next;
+	lwc_hash n, bucket;
+
+	for (n = 0; n < ctx->bucketcount; ++n) {
+		for (str = ctx->buckets[n]; str != NULL; str = next) {
+			next = STATE_OF(str)->next;
+			STATE_OF(str)->next = all;
+			all = str;
+		}
+		ctx->buckets[n] = NULL;
+	}
+
+	for (str = all; str != NULL; str = next) {
+		next = STATE_OF(str)->next;
+		bucket = lwc__keyed_hash(CSTR_OF(str), str->len) %
+			ctx->bucketcount;
+		lwc__chain_link(str, bucket);
+	}
+
+	ctx->keyed = true;
+}
+
+/**
+ * Make sure the hash seed has been chosen before hashing anything.
+ */
+static inline void
+lwc__ensure_seeded(void)
+{
+	if (LWC_LOAD_ACQUIRE(&lwc__seeded) == false) {
+		LWC_LOCK();
+		if (lwc__seeded == false)
+			lwc__initialise_seed();
+		LWC_UNLOCK();
+	}
+}
+
+bool
+lwc__has_strings(void)
+{
+	if (ctx != NULL && ctx->count > 0)
+		lwc_collect();
+
+	return ((ctx != NULL) && (ctx->count > 0)) ||
+		LWC_LOAD_ACQUIRE(&lwc__frozen) != NULL;
+}
+
+static size_t lwc__reclaim_batch(size_t budget);
+
+static void
+lwc__finalise(void)
+{
+	(void) lwc__reclaim_batch(SIZE_MAX);
+
+#ifdef LWC_SPLIT_LAYOUT
+	while (ctx->state_blocks != NULL) {
+		lwc_state_block *block = ctx->state_blocks;
+
+		ctx->state_blocks = block->next;
+		LWC_FREE(block, sizeof(lwc_state_block));
+	}
+#endif
+	if (ctx->prefixes != NULL)
+		lwc__prefix_destroy(ctx->prefixes);
+	LWC_FREE(ctx->buckets, sizeof(lwc_string *) * ctx->bucketcount);
+	LWC_FREE(ctx, sizeof(lwc_context));
+	ctx = NULL;
+}
+
+static lwc_error
+lwc__initialise(void)
+{
+	if (ctx != NULL)
+		return lwc_error_ok;
+
+	if (LWC_LOAD_ACQUIRE(&lwc__seeded) == false)
+		lwc__initialise_seed();
+
+	ctx = LWC_ALLOC(sizeof(lwc_context));
+
+	if (ctx == NULL)
+		return lwc_error_oom;
+
+	memset(ctx, 0, sizeof(lwc_context));
+
+	ctx->bucketcount = NR_BUCKETS_DEFAULT;
+	ctx->buckets = LWC_ALLOC(sizeof(lwc_string *) * ctx->bucketcount);
+
+	if (ctx->buckets == NULL) {
+		LWC_FREE(ctx, sizeof(lwc_context));
+		ctx = NULL;
+		return lwc_error_oom;
+	}
+
+	memset(ctx->buckets, 0, sizeof(lwc_string *) * ctx->bucketcount);
+
+#ifdef LWC_HASH_KEYED
+	ctx->keyed = true;
 #endif
 
-static inline lwc_hash
-lwc__calculate_hash(const char *str, size_t len)
+	return lwc_error_ok;
+}
+
+/**** Reference counting ****/
+
+static void lwc__string_free(lwc_string *str);
+
+#ifdef LWC_WITH_THREADS
+
+/**
+ * Hand the owner's references on a string over to the shared count.
+ *
+ * Called by the owner, with the table locked, as it drains its queue or
+ * exits.  Strings which have already been merged are left as they are
+ * but for the flags.
+ *
+ * @param str   The string to merge.
+ * @param clear Flags to clear in the shared word at the same time.
+ * @return The new shared word.
+ */
+static uint32_t
+lwc__string_fold(lwc_string *str, uint32_t clear)
+{
+	lwc_string_state *state = STATE_OF(str);
+	uint32_t old = __atomic_load_n(&state->shared, __ATOMIC_RELAXED);
+	uint32_t new;
+
+	do {
+		new = ((old + state->refcnt * LWC__SHARED_ONE) |
+		       LWC__SHARED_MERGED) & ~clear;
+	} while (!__atomic_compare_exchange_n(&state->shared, &old, new, true,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	state->refcnt = 0;
+	LWC_STORE_RELEASE(&state->owner, NULL);
+
+	return new;
+}
+
+/**
+ * Merge a string whose owner has released its last reference.
+ *
+ * @return true if the string is dead and the caller must destroy it.
+ */
+static bool
+lwc__string_drop_owned(lwc_string *str)
+{
+	lwc_string_state *state = STATE_OF(str);
+	uint32_t old = __atomic_load_n(&state->shared, __ATOMIC_RELAXED);
+	uint32_t new;
+
+	/* Once the string is merged, whoever drops the last reference may
+	 * free it, so give it up first.  Until then other threads take the
+	 * shared path, which is right whoever owns the string. */
+	LWC_STORE_RELEASE(&state->owner, NULL);
+
+	do {
+		/* Already in our queue, which will see to it */
+		if (old & LWC__SHARED_QUEUED) {
+			LWC_STORE_RELEASE(&state->owner, &lwc__thread);
+			return false;
+		}
+		new = old | LWC__SHARED_MERGED;
+	} while (!__atomic_compare_exchange_n(&state->shared, &old, new, true,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	return new == LWC__SHARED_MERGED;
+}
+
+/**
+ * Release a reference held by a thread other than the string's owner.
+ *
+ * @return true if the string is dead and the caller must destroy it.
+ */
+static bool
+lwc__string_drop_shared(lwc_string *str)
+{
+	lwc_string_state *state = STATE_OF(str);
+	struct lwc_thread_s *owner = LWC_LOAD_ACQUIRE(&state->owner);
+	uint32_t old, new;
+
+	/* If we release references the owner took, only the owner can
+	 * tell whether any are left, so we ask it to merge the string.
+	 * That has to happen in the same step as the release: once our
+	 * reference is gone, only a queued string is safe to touch. */
+	old = __atomic_load_n(&state->shared, __ATOMIC_RELAXED);
+	do {
+		new = old - LWC__SHARED_ONE;
+		if ((new & LWC__SHARED_MERGED) == 0 &&
+				LWC_SHARED_COUNT(new) < 0)
+			new |= LWC__SHARED_QUEUED;
+	} while (!__atomic_compare_exchange_n(&state->shared, &old, new, true,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	if (new & LWC__SHARED_MERGED)
+		return new == LWC__SHARED_MERGED;
+
+	if ((new & LWC__SHARED_QUEUED) == 0 || (old & LWC__SHARED_QUEUED))
+		return false;
+
+	assert(owner != NULL);
+
+	state->queued = __atomic_load_n(&owner->queue, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&owner->queue, &state->queued, str,
+			true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return false;
+}
+
+/**
+ * Release a reference on a string, leaving it to the caller to act on
+ * its death.
+ *
+ * @return true if the string is dead and the caller must destroy it.
+ */
+static bool
+lwc__string_drop(lwc_string *str)
+{
+	lwc_string_state *state = STATE_OF(str);
+	struct lwc_thread_s *owner = LWC_LOAD_ACQUIRE(&state->owner);
+
+	if (owner == &lwc__thread)
+		return (--state->refcnt == 0) && lwc__string_drop_owned(str);
+	else if (owner == LWC__OWNER_STATIC)
+		return false;
+
+	return lwc__string_drop_shared(str);
+}
+
+/**
+ * Take a reference on a string found in the table.
+ *
+ * @return true on success, or false if the string is dead and about to
+ *	   be destroyed by another thread.
+ */
+static bool
+lwc__string_revive(lwc_string *str)
+{
+	lwc_string_state *state = STATE_OF(str);
+	struct lwc_thread_s *owner = LWC_LOAD_ACQUIRE(&state->owner);
+	uint32_t old, new;
+
+	if (owner == &lwc__thread) {
+		state->refcnt++;
+		return true;
+	} else if (owner == LWC__OWNER_STATIC) {
+		return true;
+	}
+
+	old = __atomic_load_n(&state->shared, __ATOMIC_RELAXED);
+	do {
+		if ((old & LWC__SHARED_MERGED) &&
+				LWC_SHARED_COUNT(old) == 0 &&
+				lwc__reclaim != lwc_reclaim_deferred)
+			return false;
+		new = old + LWC__SHARED_ONE;
+	} while (!__atomic_compare_exchange_n(&state->shared, &old, new, true,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	return true;
+}
+
+/**
+ * Merge the strings other threads have queued for us, with the table
+ * locked.
+ *
+ * @return The number of strings merged.
+ */
+static size_t
+lwc__thread_drain(void)
+{
+	lwc_string *str, *next;
+	size_t merged = 0;
+
+	str = __atomic_exchange_n(&lwc__thread.queue, NULL, __ATOMIC_ACQUIRE);
+
+	for (; str != NULL; str = next) {
+		next = STATE_OF(str)->queued;
+		merged++;
+
+		/* Queued strings are never freed, so next is safe */
+		if (lwc__string_fold(str, LWC__SHARED_QUEUED) ==
+				LWC__SHARED_MERGED &&
+				lwc__reclaim != lwc_reclaim_deferred)
+			lwc__string_free(str);
+	}
+
+	return merged;
+}
+
+/**
+ * Merge every string biased towards a thread which is exiting.
+ */
+static void
+lwc__thread_exit(void *pw)
+{
+	lwc_string *str, *dead = NULL;
+	size_t queued = 0;
+	lwc_hash n;
+
+	UNUSED(pw);
+
+	LWC_LOCK();
+
+	for (n = 0; ctx != NULL && n < ctx->bucketcount; ++n) {
+		for (str = ctx->buckets[n]; str != NULL;
+				str = STATE_OF(str)->next) {
+			uint32_t word;
+
+			if (LWC_LOAD_ACQUIRE(&STATE_OF(str)->owner) !=
+					&lwc__thread)
+				continue;
+
+			word = lwc__string_fold(str, 0);
+			if (word & LWC__SHARED_QUEUED) {
+				queued++;
+			} else if (word == LWC__SHARED_MERGED &&
+					lwc__reclaim != lwc_reclaim_deferred) {
+				/* Free it once we're done walking */
+				STATE_OF(str)->queued = dead;
+				dead = str;
+			}
+		}
+	}
+
+	/* Frozen strings can't die, but they would be left biased towards
+	 * whichever thread next has our address. */
+	if (lwc__frozen != NULL) {
+		for (n = 0; n < lwc__frozen->count; ++n) {
+			str = lwc__frozen->slots[n];
+			if (LWC_LOAD_ACQUIRE(&STATE_OF(str)->owner) ==
+					&lwc__thread)
+				(void) lwc__string_fold(str, 0);
+		}
+	}
+
+	/* Other threads may be part way through queueing strings for us,
+	 * and our queue will be gone once we are. */
+	while (queued > 0) {
+		queued -= lwc__thread_drain();
+		if (queued > 0)
+			sched_yield();
+	}
+
+	while (dead != NULL) {
+		str = dead;
+		dead = STATE_OF(str)->queued;
+		lwc__string_free(str);
+	}
+
+	LWC_UNLOCK();
+}
+
+static void
+lwc__thread_init(void)
+{
+	pthread_key_create(&lwc__exit_key, lwc__thread_exit);
+}
+
+/**
+ * Make a new string belong to the calling thread.
+ */
+static void
+lwc__string_own(lwc_string *str)
+{
+	lwc_string_state *state = STATE_OF(str);
+
+	if (lwc__thread.registered == false) {
+		pthread_once(&lwc__once, lwc__thread_init);
+		pthread_setspecific(lwc__exit_key, &lwc__thread);
+		lwc__thread.registered = true;
+	}
+
+	state->refcnt = 1;
+	state->owner = &lwc__thread;
+	state->shared = 0;
+	state->queued = NULL;
+}
+
+void
+lwc__string_merge(lwc_string *str)
+{
+	if (lwc__string_drop_owned(str))
+		lwc_string_destroy(str);
+}
+
+void
+lwc__string_unref_shared(lwc_string *str)
+{
+	if (lwc__string_drop_shared(str))
+		lwc_string_destroy(str);
+}
+
+#else
+
+static inline bool
+lwc__string_drop(lwc_string *str)
+{
+	return lwc__string_static(str) == false &&
+			--STATE_OF(str)->refcnt == 0;
+}
+
+static inline bool
+lwc__string_revive(lwc_string *str)
+{
+	if (lwc__string_static(str) == false)
+		STATE_OF(str)->refcnt++;
+	return true;
+}
+
+static inline void
+lwc__string_own(lwc_string *str)
+{
+	STATE_OF(str)->refcnt = 1;
+}
+
+#endif
+
+/**
+ * Look a string up in the frozen table, if there is one.
+ *
+ * This needs no lock, as frozen tables never change and frozen strings
+ * never die.
+ *
+ * @return The string, with a new reference on it, or NULL if it isn't
+ *	   frozen.
+ */
+static inline lwc_string *
+lwc__intern_frozen(const char *s, size_t slen, lwc_hash h,
+		   const uint64_t word[2], lwc_strncmp compare)
+{
+	const lwc_frozen *frozen = LWC_LOAD_ACQUIRE(&lwc__frozen);
+	lwc_string *str;
+
+	if (frozen == NULL)
+		return NULL;
+
+	str = lwc__frozen_find(frozen, h);
+	if ((str->hash != h) || (str->len != slen) ||
+			lwc__matches(str, s, slen, word, compare) == false)
+		return NULL;
+
+	(void) lwc__string_revive(str);
+
+	return str;
+}
+
+/**
+ * Intern a string which isn't frozen, with the table locked.
+ *
+ * @param h    The hash of the string, as it will be stored.
+ * @param ch   The hash of the caseless form of the string.
+ * @param word The words of the string as stored, if it is short.
+ * @param start When the operation started, from LWC_TRACE_START.
+ */
+static lwc_error
+lwc__intern(const char *s, size_t slen, lwc_hash h, lwc_hash ch,
+	   const uint64_t word[2], uint64_t start,
+	   lwc_string **ret,
+	   lwc_keyed_hasher keyed,
+	   lwc_strncmp compare,
+	   lwc_memcpy copy)
+{
+	lwc_hash bucket;
+	lwc_string *str;
+	lwc_error eret;
+	size_t chain = 0;
+
+	assert((s != NULL) || (slen == 0));
+	assert(ret);
+
+	if (ctx == NULL) {
+		eret = lwc__initialise();
+		if (eret != lwc_error_ok)
+			return eret;
+		if (ctx == NULL)
+			return lwc_error_oom;
+	}
+
+	for (str = lwc__shm_chain(h); str != NULL; str = lwc__shm_next(str)) {
+		if ((str->hash == h) && (str->len == slen)) {
+			if (lwc__matches(str, s, slen, word, compare) &&
+					lwc__string_revive(str)) {
+				*ret = str;
+				LWC_TRACE(intern_hit, str, start);
+				return lwc_error_ok;
+			}
+		}
+	}
+
+	if (ctx->keyed)
+		bucket = keyed(s, slen) % ctx->bucketcount;
+	else
+		bucket = h % ctx->bucketcount;
+	str = ctx->buckets[bucket];
+
+	while (str != NULL) {
+		if ((str->hash == h) && (str->len == slen)) {
+			if (lwc__matches(str, s, slen, word, compare) &&
+					lwc__string_revive(str)) {
+				*ret = str;
+				LWC_TRACE(intern_hit, str, start);
+				return lwc_error_ok;
+			}
+		}
+		str = STATE_OF(str)->next;
+		chain++;
+	}
+
+	/* An unreasonably long chain for the load we're carrying means
+	 * somebody can predict our bucket choice; stop letting them. */
+	if (ctx->keyed == false && chain > LWC_CHAIN_LIMIT +
+			4 * (ctx->count / ctx->bucketcount)) {
+		lwc__rekey();
+		bucket = keyed(s, slen) % ctx->bucketcount;
+	}
+
+	/* Add one for the additional NUL. */
+	*ret = str = LWC_ALLOC(sizeof(lwc_string) + slen + 1);
+
+	if (str == NULL)
+		return lwc_error_oom;
+
+#ifdef LWC_SPLIT_LAYOUT
+	str->state = lwc__state_alloc();
+	if (str->state == NULL) {
+		LWC_FREE(str, sizeof(lwc_string) + slen + 1);
+		*ret = NULL;
+		return lwc_error_oom;
+	}
+#endif
+
+	lwc__chain_link(str, bucket);
+	ctx->count++;
+
+	str->len = slen;
+	str->hash = h;
+	str->chash = ch;
+	STATE_OF(str)->insensitive = NULL;
+#if LWC_USER_SLOTS > 0
+	memset(STATE_OF(str)->user, 0, sizeof(STATE_OF(str)->user));
+#endif
+#ifdef LWC_WITH_RECORD
+	STATE_OF(str)->record_id = 0;
+#endif
+	lwc__string_own(str);
+
+	copy(STR_OF(str), s, slen);
+
+	/* Guarantee NUL termination */
+	STR_OF(str)[slen] = '\0';
+
+	if (ctx->prefixes != NULL &&
+			lwc__prefix_insert(ctx->prefixes, str) != lwc_error_ok) {
+		/* The index is only a cache; drop it rather than fail */
+		lwc__prefix_destroy(ctx->prefixes);
+		ctx->prefixes = NULL;
+	}
+
+	LWC_TRACE(intern_miss, str, start);
+
+	return lwc_error_ok;
+}
+
+static lwc_error
+lwc__intern_string(const char *s, size_t slen, lwc_string **ret)
+{
+	uint64_t word[2];
+	lwc_hash h, ch;
+	lwc_error err;
+	LWC_TRACE_START(start);
+
+	assert((s != NULL) || (slen == 0));
+	assert(ret);
+
+	lwc__ensure_seeded();
+	lwc__calculate_hashes(s, slen, word, &h, &ch);
+
+	/* Known strings are found without taking the lock at all */
+	*ret = lwc__intern_frozen(s, slen, h, word, strncmp);
+	if (*ret != NULL) {
+		LWC_TRACE(intern_hit, *ret, start);
+		return lwc_error_ok;
+	}
+
+	LWC_LOCK();
+#ifdef LWC_WITH_THREADS
+	if (LWC_LOAD_ACQUIRE(&lwc__thread.queue) != NULL)
+		lwc__thread_drain();
+#endif
+	err = lwc__intern(s, slen, h, ch, word, start, ret,
+			  lwc__keyed_hash,
+			  strncmp, (lwc_memcpy)memcpy);
+	LWC_UNLOCK();
+
+	return err;
+}
+
+lwc_error
+lwc_intern_string(const char *s, size_t slen,
+		  lwc_string **ret)
+{
+	lwc_error err = lwc__intern_string(s, slen, ret);
+
+	if (err == lwc_error_ok)
+		LWC__RECORD(intern(*ret));
+
+	return err;
+}
+
+lwc_error
+lwc__intern_bulk(lwc_bulk_next_fn next, void *pw, lwc_string **strs,
+		 size_t *n)
+{
+	lwc_bulk_entry entry;
+	lwc_error err = lwc_error_ok;
+	size_t i, done;
+
+	assert(n != NULL);
+	assert((strs != NULL) || (*n == 0));
+
+	lwc__ensure_seeded();
+
+	LWC_LOCK();
+#ifdef LWC_WITH_THREADS
+	if (LWC_LOAD_ACQUIRE(&lwc__thread.queue) != NULL)
+		lwc__thread_drain();
+#endif
+	for (i = 0; i < *n; i++) {
+		LWC_TRACE_START(start);
+
+		err = next(pw, &entry);
+		if (err == lwc_error_range) {
+			err = lwc_error_ok;
+			break;
+		} else if (err != lwc_error_ok) {
+			break;
+		}
+
+		if (entry.hashed == false)
+			lwc__calculate_hashes(entry.s, entry.len, entry.word,
+					&entry.hash, &entry.chash);
+
+		strs[i] = lwc__intern_frozen(entry.s, entry.len, entry.hash,
+				entry.word, strncmp);
+		if (strs[i] != NULL) {
+			LWC_TRACE(intern_hit, strs[i], start);
+			continue;
+		}
+
+		err = lwc__intern(entry.s, entry.len, entry.hash, entry.chash,
+				  entry.word, start, &strs[i],
+				  lwc__keyed_hash,
+				  strncmp, (lwc_memcpy)memcpy);
+		if (err != lwc_error_ok)
+			break;
+	}
+	LWC_UNLOCK();
+
+	for (done = 0; done < i; done++)
+		LWC__RECORD(intern(strs[done]));
+
+	if (err != lwc_error_ok)
+		lwc_string_unref_many(strs, i);
+	else
+		*n = i;
+
+	return err;
+}
+
+lwc_hash
+lwc_calculate_hash(const char *s, size_t slen)
+{
+	assert((s != NULL) || (slen == 0));
+
+	lwc__ensure_seeded();
+
+	return lwc__calculate_hash(s, slen);
+}
+
+lwc_error
+lwc_intern_substring(lwc_string *str,
+		     size_t ssoffset, size_t sslen,
+		     lwc_string **ret)
+{
+	lwc_error err;
+
+	assert(str);
+	assert(ret);
+
+	if (ssoffset >= str->len)
+		return lwc_error_range;
+	if ((ssoffset + sslen) > str->len)
+		return lwc_error_range;
+
+	err = lwc__intern_string(CSTR_OF(str) + ssoffset, sslen, ret);
+	if (err == lwc_error_ok)
+		LWC__RECORD(substring(*ret, str, ssoffset));
+
+	return err;
+}
+
+lwc_error
+lwc_string_tolower(lwc_string *str, lwc_string **ret)
+{
+	assert(str);
+	assert(ret);
+
+	/* Internally make use of knowledge that insensitive strings
+	 * are lower case. */
+	if (lwc__string_insensitive(str) == NULL) {
+		lwc_error error = lwc__intern_caseless_string(str);
+		if (error != lwc_error_ok) {
+			return error;
+		}
+	}
+
+	/* The caseless form is held by str, so can't be dead */
+	*ret = lwc__string_insensitive(str);
+	(void) lwc__string_revive(*ret);
+
+	LWC__RECORD(tolower(*ret, str));
+
+	return lwc_error_ok;
+}
+
+/**
+ * Give the memory of a string which is no longer interned back.
+ */
+static void
+lwc__string_release(lwc_string *str)
+{
+	size_t size = sizeof(lwc_string) + str->len + 1;
+
+#ifdef LWC_SPLIT_LAYOUT
+	lwc__state_free(str->state);
+#endif
+
+#ifndef NDEBUG
+	memset(str, 0xA5, sizeof(*str) + str->len);
+#endif
+
+	LWC_FREE(str, size);
+}
+
+static void
+lwc__string_free(lwc_string *str)
+{
+	lwc_string *insensitive = STATE_OF(str)->insensitive;
+	LWC_TRACE_START(start);
+
+	/* Reported while the string can still be looked at, timed once it's
+	 * gone */
+	LWC_TRACE(destroy, str, 0);
+	LWC__RECORD(forget(str));
+
+#if LWC_USER_SLOTS > 0
+	{
+		unsigned int slot;
+
+		for (slot = 0; slot < lwc__user_slots; slot++) {
+			if (STATE_OF(str)->user[slot] != NULL &&
+					lwc__user_destructor[slot] != NULL)
+				lwc__user_destructor[slot](str,
+						STATE_OF(str)->user[slot],
+						lwc__user_pw[slot]);
+		}
+	}
+#endif
+
+	lwc__chain_unlink(str);
+
+	ctx->count--;
+
+	if (ctx->prefixes != NULL)
+		lwc__prefix_remove(ctx->prefixes, str);
+
+	/* The caseless form only holds a reference if it isn't us */
+	if (insensitive != NULL && insensitive != str &&
+			lwc__string_drop(insensitive) &&
+			lwc__reclaim != lwc_reclaim_deferred)
+		lwc__string_free(insensitive);
+
+	/* Unlinked, so the chain link is free to queue it with */
+	if (lwc__reclaim == lwc_reclaim_background) {
+		STATE_OF(str)->next = ctx->dying;
+		ctx->dying = str;
+		LWC_TRACE_TIME(destroy, start);
+		return;
+	}
+
+	lwc__string_release(str);
+	LWC_TRACE_TIME(destroy, start);
+}
+
+void
+lwc_string_destroy(lwc_string *str)
+{
+	assert(str);
+
+	/* Dead strings stay put until collected, which is what lets
+	 * interning them again bring them back for free. */
+	LWC_LOCK();
+	if (lwc__reclaim != lwc_reclaim_deferred)
+		lwc__string_free(str);
+	LWC_UNLOCK();
+}
+
+/**
+ * Free every dead string, with the table locked.
+ */
+static size_t
+lwc__collect(void)
+{
+	lwc_reclaim_mode mode = lwc__reclaim;
+	size_t freed = 0, pass;
+	lwc_hash n;
+	lwc_string *str, *next;
+
+	if (ctx == NULL)
+		return 0;
+
+#ifdef LWC_WITH_THREADS
+	if (LWC_LOAD_ACQUIRE(&lwc__thread.queue) != NULL)
+		lwc__thread_drain();
+
+	/* Any dead strings belong to the threads which saw them die,
+	 * which may be waiting for the lock to free them. */
+	if (mode == lwc_reclaim_immediate)
+		return 0;
+#endif
+
+	/* Strings leave the table as they die */
+	if (mode == lwc_reclaim_background)
+		return 0;
+
+	/* Freeing a string releases its reference on its caseless form,
+	 * which may kill that in turn.  It mustn't be freed under our
+	 * feet, so defer it and catch it in another pass. */
+	lwc__reclaim = lwc_reclaim_deferred;
+
+	do {
+		pass = 0;
+
+		for (n = 0; n < ctx->bucketcount; ++n) {
+			for (str = ctx->buckets[n]; str != NULL; str = next) {
+				next = STATE_OF(str)->next;
+				if (lwc__string_dead(str)) {
+					lwc__string_free(str);
+					pass++;
+				}
+			}
+		}
+
+		freed += pass;
+	} while (pass > 0);
+
+	lwc__reclaim = mode;
+
+	return freed;
+}
+
+size_t
+lwc_collect(void)
+{
+	size_t freed;
+
+	LWC_LOCK();
+	freed = lwc__collect();
+	LWC_UNLOCK();
+
+	return freed;
+}
+
+/* Strings freed by lwc_reclaim() with the table locked at a time */
+#define RECLAIM_BATCH		(32)
+
+/**
+ * Free up to \a budget queued strings, with the table locked.
+ */
+static size_t
+lwc__reclaim_batch(size_t budget)
+{
+	size_t freed = 0;
+
+	while (ctx != NULL && ctx->dying != NULL && freed < budget) {
+		lwc_string *str = ctx->dying;
+
+		ctx->dying = STATE_OF(str)->next;
+		lwc__string_release(str);
+		freed++;
+	}
+
+	return freed;
+}
+
+size_t
+lwc_reclaim(size_t budget)
+{
+	size_t freed = 0, batch;
+
+	do {
+		batch = budget - freed;
+		if (batch > RECLAIM_BATCH)
+			batch = RECLAIM_BATCH;
+
+		LWC_LOCK();
+		batch = lwc__reclaim_batch(batch);
+		LWC_UNLOCK();
+
+		freed += batch;
+	} while (batch == RECLAIM_BATCH && freed < budget);
+
+	return freed;
+}
+
+lwc_error
+lwc_set_reclaim_mode(lwc_reclaim_mode mode)
+{
+#ifdef LWC_DEFERRED_RECLAIM
+	if (mode != lwc_reclaim_deferred)
+		return lwc_error_unsupported;
+#else
+	if (mode != lwc_reclaim_immediate && mode != lwc_reclaim_deferred &&
+			mode != lwc_reclaim_background)
+		return lwc_error_unsupported;
+
+	/* Nothing would ever free the strings already dead, or those
+	 * queued once nothing is queueing them */
+	if (mode != lwc_reclaim_deferred)
+		lwc_collect();
+	if (mode != lwc_reclaim_background)
+		(void) lwc_reclaim(SIZE_MAX);
+#endif
+
+	lwc__reclaim = mode;
+
+	return lwc_error_ok;
+}
+
+/* How far ahead of the current string to prefetch in bulk operations */
+#define PREFETCH_DISTANCE	(8)
+
+void
+lwc_string_unref_many(lwc_string **strs, size_t n)
+{
+	size_t i, dead = 0;
+
+	assert((strs != NULL) || (n == 0));
+
+	/* Drop all the references first, gathering the strings which die
+	 * at the front of the array.  Gathering on the transition means
+	 * strings present more than once are only gathered once. */
+	for (i = 0; i < n; i++) {
+		lwc_string *str = strs[i];
+
+		if (i + PREFETCH_DISTANCE < n)
+			LWC_PREFETCH(strs[i + PREFETCH_DISTANCE]);
+
+		assert(str != NULL);
+
+		LWC__RECORD(unref(str));
+		if (lwc__string_drop(str))
+			strs[dead++] = str;
+	}
+
+	if (dead == 0)
+		return;
+
+	LWC_LOCK();
+
+	if (lwc__reclaim != lwc_reclaim_deferred) {
+		for (i = 0; i < dead; i++) {
+			if (i + PREFETCH_DISTANCE < dead)
+				LWC_PREFETCH(strs[i + PREFETCH_DISTANCE]);
+
+			lwc__string_free(strs[i]);
+		}
+	}
+
+	LWC_UNLOCK();
+}
+
+/**** Shonky caseless bits ****/
+
+static int
+lwc__lcase_strncmp(const char *s1, const char *s2, size_t n)
+{
+	while (n--) {
+		if (*s1++ != lwc__dolower(*s2++))
+			/** @todo Test this somehow? */
+			return 1;
+	}
+	return 0;
+}
+
+static void *
+lwc__lcase_memcpy(void *restrict _target, const void *restrict _source, size_t n)
 {
-	lwc_hash z = 0x811c9dc5;
+	char *restrict target = _target;
+	const char *restrict source = _source;
 
-	while (len > 0) {
-		z *= 0x01000193;
-		z ^= *str++;
-		len--;
+	while (n--) {
+		*target++ = lwc__dolower(*source++);
 	}
 
-	return z;
+	return _target;
 }
 
-#define STR_OF(str) ((char *)(str + 1))
-#define CSTR_OF(str) ((const char *)(str + 1))
-
-#define NR_BUCKETS_DEFAULT	(4091)
+bool
+lwc__string_caseless_compare(const lwc_string *str1, const lwc_string *str2)
+{
+	const char *s1 = CSTR_OF(str1), *s2 = CSTR_OF(str2);
+	size_t n = str1->len;
 
-typedef struct lwc_context_s {
-	lwc_string **		buckets;
-	lwc_hash		bucketcount;
-} lwc_context;
+	/* Shared strings link to their caseless forms where the inline
+	 * comparison doesn't look */
+	if (lwc__shm_contains(str1) || lwc__shm_contains(str2)) {
+		lwc_string *insensitive1, *insensitive2;
 
-static lwc_context *ctx = NULL;
+		insensitive1 = lwc__string_insensitive(str1);
+		insensitive2 = lwc__string_insensitive(str2);
+		if (insensitive1 != NULL && insensitive2 != NULL)
+			return insensitive1 == insensitive2;
+	}
 
-#define LWC_ALLOC(s) malloc(s)
-#define LWC_FREE(p) free(p)
+#ifdef LWC_UNICODE_FOLD
+	/* Strings of different lengths may fold to the same one */
+	if (lwc__is_ascii(s1, str1->len) == false ||
+			lwc__is_ascii(s2, str2->len) == false)
+		return lwc__fold_equal(s1, str1->len, s2, str2->len);
 
-typedef lwc_hash (*lwc_hasher)(const char *, size_t);
-typedef int (*lwc_strncmp)(const char *, const char *, size_t);
-typedef void * (*lwc_memcpy)(void * restrict, const void * restrict, size_t);
+	if (str1->len != str2->len)
+		return false;
+#endif
 
-static lwc_error
-lwc__initialise(void)
-{
-	if (ctx != NULL)
-		return lwc_error_ok;
+	assert(str1->len == str2->len);
 
-	ctx = LWC_ALLOC(sizeof(lwc_context));
+	while (n--) {
+		if (lwc__dolower(*s1++) != lwc__dolower(*s2++))
+			return false;
+	}
 
-	if (ctx == NULL)
-		return lwc_error_oom;
+	return true;
+}
 
-	memset(ctx, 0, sizeof(lwc_context));
+#ifdef LWC_UNICODE_FOLD
+/* Strings up to this long are folded on the stack */
+#define FOLD_STACK_MAX		(256)
 
-	ctx->bucketcount = NR_BUCKETS_DEFAULT;
-	ctx->buckets = LWC_ALLOC(sizeof(lwc_string *) * ctx->bucketcount);
+/**
+ * Intern the caseless form of a string which isn't all ASCII, with the
+ * table locked.
+ *
+ * Such a string may fold to one of another length, so it is folded into
+ * a buffer first and that is interned as it is.
+ */
+static lwc_error
+lwc__intern_folded(lwc_string *str, lwc_string **ret)
+{
+	char stack[LWC_FOLD_SPACE(FOLD_STACK_MAX)], *buf = stack;
+	size_t space = LWC_FOLD_SPACE(str->len), len;
+	uint64_t word[2] = { 0, 0 };
+	lwc_error err = lwc_error_ok;
 
-	if (ctx->buckets == NULL) {
-		LWC_FREE(ctx);
-		ctx = NULL;
-		return lwc_error_oom;
+	if (str->len > FOLD_STACK_MAX) {
+		buf = LWC_ALLOC(space);
+		if (buf == NULL)
+			return lwc_error_oom;
 	}
 
-	memset(ctx->buckets, 0, sizeof(lwc_string *) * ctx->bucketcount);
+	len = lwc__fold(CSTR_OF(str), str->len, buf);
+	if (len <= LWC_SHORT_MAX)
+		lwc__short_words(buf, len, word);
 
-	return lwc_error_ok;
+	*ret = lwc__intern_frozen(buf, len, str->chash, word, strncmp);
+	if (*ret == NULL)
+		err = lwc__intern(buf, len, str->chash, str->chash, word, 0,
+				  ret,
+				  lwc__keyed_hash,
+				  strncmp, (lwc_memcpy)memcpy);
+
+	if (buf != stack)
+		LWC_FREE(buf, space);
+
+	return err;
 }
+#endif
 
+/**
+ * Intern the caseless form of a string, with the table locked.
+ */
 static lwc_error
-lwc__intern(const char *s, size_t slen,
-	   lwc_string **ret,
-	   lwc_hasher hasher,
-	   lwc_strncmp compare,
-	   lwc_memcpy copy)
+lwc__intern_caseless(lwc_string *str)
 {
+	lwc_string *insensitive;
+	uint64_t word[2];
 	lwc_hash h;
-	lwc_hash bucket;
-	lwc_string *str;
-	lwc_error eret;
-
-	assert((s != NULL) || (slen == 0));
-	assert(ret);
+	lwc_error err = lwc_error_ok;
+	LWC_TRACE_START(start);
 
-	if (ctx == NULL) {
-		eret = lwc__initialise();
-		if (eret != lwc_error_ok)
-			return eret;
-		if (ctx == NULL)
-			return lwc_error_oom;
-	}
+	/* Another thread may have got here first, and shared strings
+	 * come with theirs */
+	if (lwc__string_insensitive(str) != NULL)
+		return lwc_error_ok;
 
-	h = hasher(s, slen);
-	bucket = h % ctx->bucketcount;
-	str = ctx->buckets[bucket];
+	/* The caseless form is its own caseless form */
+	h = str->chash;
 
-	while (str != NULL) {
-		if ((str->hash == h) && (str->len == slen)) {
-			if (compare(CSTR_OF(str), s, slen) == 0) {
-				str->refcnt++;
-				*ret = str;
-				return lwc_error_ok;
-			}
+#ifdef LWC_UNICODE_FOLD
+	if (lwc__is_ascii(CSTR_OF(str), str->len) == false) {
+		err = lwc__intern_folded(str, &insensitive);
+	} else
+#endif
+	{
+		if (str->len <= LWC_SHORT_MAX) {
+			lwc__short_words(CSTR_OF(str), str->len, word);
+			word[0] = lwc__word_lower(word[0]);
+			word[1] = lwc__word_lower(word[1]);
 		}
-		str = str->next;
+
+		insensitive = lwc__intern_frozen(CSTR_OF(str), str->len, h,
+				word, lwc__lcase_strncmp);
+		if (insensitive == NULL)
+			err = lwc__intern(CSTR_OF(str),
+					  str->len, h, h, word, 0, &insensitive,
+					  lwc__keyed_lcase_hash,
+					  lwc__lcase_strncmp,
+					  lwc__lcase_memcpy);
 	}
+	if (err == lwc_error_ok) {
+		/* A string which is its own caseless form doesn't hold a
+		 * reference on itself, or it could never die.  The caller's
+		 * reference means this can't be the last one. */
+		if (insensitive == str)
+			(void) lwc__string_drop(str);
 
-	/* Add one for the additional NUL. */
-	*ret = str = LWC_ALLOC(sizeof(lwc_string) + slen + 1);
+		LWC_STORE_RELEASE(&STATE_OF(str)->insensitive, insensitive);
+		LWC_TRACE(intern_caseless, str, start);
+	}
 
-	if (str == NULL)
-		return lwc_error_oom;
+	return err;
+}
 
-	str->prevptr = &(ctx->buckets[bucket]);
-	str->next = ctx->buckets[bucket];
-	if (str->next != NULL)
-		str->next->prevptr = &(str->next);
-	ctx->buckets[bucket] = str;
+lwc_error
+lwc__intern_caseless_string(lwc_string *str)
+{
+	lwc_error err;
 
-	str->len = slen;
-	str->hash = h;
-	str->refcnt = 1;
-	str->insensitive = NULL;
+	assert(str);
 
-	copy(STR_OF(str), s, slen);
+	LWC_LOCK();
+	err = lwc__intern_caseless(str);
+	LWC_UNLOCK();
 
-	/* Guarantee NUL termination */
-	STR_OF(str)[slen] = '\0';
+	return err;
+}
+
+/**** Allocation ****/
+
+lwc_error
+lwc_set_allocator(lwc_alloc_fn alloc, lwc_free_fn free_fn,
+		  lwc_sized_free_fn sized_free, void *pw)
+{
+	assert((alloc == NULL) ||
+	       (free_fn != NULL) || (sized_free != NULL));
+
+#ifdef LWC_WITH_RECORD
+	/* The recorder holds memory from the allocator in use */
+	if (lwc__recording)
+		return lwc_error_busy;
+#endif
+
+	if (ctx != NULL) {
+		if (lwc__has_strings())
+			return lwc_error_busy;
+
+		/* The context is empty, so release it with the
+		 * allocator it came from. */
+		lwc__finalise();
+	}
+
+	if (alloc == NULL) {
+		lwc__allocator.alloc = lwc__default_alloc;
+		lwc__allocator.free = lwc__default_free;
+		lwc__allocator.sized_free = NULL;
+		lwc__allocator.pw = NULL;
+	} else {
+		lwc__allocator.alloc = alloc;
+		lwc__allocator.free = free_fn;
+		lwc__allocator.sized_free = sized_free;
+		lwc__allocator.pw = pw;
+	}
 
 	return lwc_error_ok;
 }
 
+/**** User data ****/
+
+#if LWC_USER_SLOTS > 0
+
 lwc_error
-lwc_intern_string(const char *s, size_t slen,
-		  lwc_string **ret)
+lwc_register_user_slot(lwc_user_data_destructor_fn destructor, void *pw,
+		       unsigned int *slot)
 {
-	return lwc__intern(s, slen, ret,
-			   lwc__calculate_hash,
-			   strncmp, (lwc_memcpy)memcpy);
+	lwc_error err = lwc_error_range;
+
+	assert(slot);
+
+	LWC_LOCK();
+	if (lwc__user_slots < LWC_USER_SLOTS) {
+		*slot = lwc__user_slots;
+		lwc__user_destructor[*slot] = destructor;
+		lwc__user_pw[*slot] = pw;
+		LWC_STORE_RELEASE(&lwc__user_slots, *slot + 1);
+		err = lwc_error_ok;
+	}
+	LWC_UNLOCK();
+
+	return err;
 }
 
 lwc_error
-lwc_intern_substring(lwc_string *str,
-		     size_t ssoffset, size_t sslen,
-		     lwc_string **ret)
+lwc_string_set_user_data(lwc_string *str, unsigned int slot, void *data)
 {
+	void *empty = NULL;
+
 	assert(str);
-	assert(ret);
+	assert(data);
 
-	if (ssoffset >= str->len)
-		return lwc_error_range;
-	if ((ssoffset + sslen) > str->len)
+	if (slot >= LWC_LOAD_ACQUIRE(&lwc__user_slots))
 		return lwc_error_range;
 
-	return lwc_intern_string(CSTR_OF(str) + ssoffset, sslen, ret);
+	/* Other processes would see our pointers */
+	if (lwc__shm_contains(str))
+		return lwc_error_invalid;
+
+#ifdef LWC_WITH_THREADS
+	if (__atomic_compare_exchange_n(&STATE_OF(str)->user[slot], &empty,
+			data, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED) == false)
+		return lwc_error_busy;
+#else
+	if (STATE_OF(str)->user[slot] != empty)
+		return lwc_error_busy;
+	STATE_OF(str)->user[slot] = data;
+#endif
+
+	return lwc_error_ok;
 }
 
+#else
+
 lwc_error
-lwc_string_tolower(lwc_string *str, lwc_string **ret)
+lwc_register_user_slot(lwc_user_data_destructor_fn destructor, void *pw,
+		       unsigned int *slot)
 {
-	assert(str);
-	assert(ret);
+	UNUSED(destructor);
+	UNUSED(pw);
+	UNUSED(slot);
 
-	/* Internally make use of knowledge that insensitive strings
-	 * are lower case. */
-	if (str->insensitive == NULL) {
-		lwc_error error = lwc__intern_caseless_string(str);
-		if (error != lwc_error_ok) {
-			return error;
+	return lwc_error_unsupported;
+}
+
+lwc_error
+lwc_string_set_user_data(lwc_string *str, unsigned int slot, void *data)
+{
+	UNUSED(str);
+	UNUSED(slot);
+	UNUSED(data);
+
+	return lwc_error_unsupported;
+}
+
+#endif
+
+/**** Freezing ****/
+
+/**
+ * Gather every live string in the private table, with it locked.
+ *
+ * @param ret	Pointer to location to receive the array of strings.
+ * @param n	Pointer to location to receive the number gathered.
+ * @param space Pointer to location to receive the size of the array.
+ */
+static lwc_error
+lwc__gather(lwc_string ***ret, size_t *n, size_t *space)
+{
+	lwc_string **strs, *str;
+	lwc_hash b;
+
+	*ret = NULL;
+	*n = *space = 0;
+
+	if (ctx == NULL || ctx->count == 0)
+		return lwc_error_ok;
+
+	strs = LWC_ALLOC(sizeof(lwc_string *) * ctx->count);
+	if (strs == NULL)
+		return lwc_error_oom;
+
+	for (b = 0; b < ctx->bucketcount; ++b) {
+		for (str = ctx->buckets[b]; str != NULL; str = STATE_OF(str)->next) {
+			if (lwc__string_dead(str) == false)
+				strs[(*n)++] = str;
 		}
 	}
 
-	*ret = lwc_string_ref(str->insensitive);
+	*ret = strs;
+	*space = ctx->count;
+
 	return lwc_error_ok;
 }
 
-void
-lwc_string_destroy(lwc_string *str)
+/**
+ * Intern the caseless forms of every live string in the private table,
+ * and those of the caseless forms, with it locked.
+ */
+static lwc_error
+lwc__close_caseless(void)
 {
-	assert(str);
+	lwc_string **strs;
+	size_t i, n, space;
+	lwc_error err;
+
+	err = lwc__gather(&strs, &n, &space);
+	for (i = 0; err == lwc_error_ok && i < n; i++) {
+		err = lwc__intern_caseless(strs[i]);
+		if (err == lwc_error_ok)
+			err = lwc__intern_caseless(STATE_OF(strs[i])->insensitive);
+	}
+	if (strs != NULL)
+		LWC_FREE(strs, sizeof(lwc_string *) * space);
+
+	return err;
+}
 
-	*(str->prevptr) = str->next;
+lwc_error
+lwc_freeze(void)
+{
+	lwc_string **strs, *str;
+	lwc_frozen *frozen;
+	size_t i, n, space;
+	lwc_error err;
 
-	if (str->next != NULL)
-		str->next->prevptr = str->prevptr;
+	LWC_LOCK();
 
-	if (str->insensitive != NULL && str->refcnt == 0)
-		lwc_string_unref(str->insensitive);
+	if (lwc__frozen != NULL) {
+		LWC_UNLOCK();
+		return lwc_error_busy;
+	}
 
-#ifndef NDEBUG
-	memset(str, 0xA5, sizeof(*str) + str->len);
+	/* Frozen strings are meant to be left alone */
+	err = lwc__close_caseless();
+	if (err == lwc_error_ok)
+		err = lwc__gather(&strs, &n, &space);
+	if (err != lwc_error_ok) {
+		LWC_UNLOCK();
+		return err;
+	}
+
+	err = lwc__frozen_build(strs, n, &frozen);
+	if (strs != NULL)
+		LWC_FREE(strs, sizeof(lwc_string *) * space);
+	if (err != lwc_error_ok || frozen == NULL) {
+		LWC_UNLOCK();
+		return err;
+	}
+
+	/* Take the strings out of the chains, leaving behind only those
+	 * the perfect hash couldn't take, and make them immortal */
+	for (i = 0; i < frozen->count; i++) {
+		str = frozen->slots[i];
+
+		lwc__chain_unlink(str);
+		STATE_OF(str)->prevptr = NULL;
+		STATE_OF(str)->next = NULL;
+		ctx->count--;
+
+#ifdef LWC_WITH_THREADS
+		__atomic_fetch_add(&STATE_OF(str)->shared,
+				LWC_REFCNT_IMMORTAL * LWC__SHARED_ONE,
+				__ATOMIC_ACQ_REL);
+#else
+		STATE_OF(str)->refcnt += LWC_REFCNT_IMMORTAL;
 #endif
+	}
 
-	LWC_FREE(str);
-}
+	LWC_STORE_RELEASE(&lwc__frozen, frozen);
 
-/**** Shonky caseless bits ****/
+	LWC_UNLOCK();
 
-static inline char
-lwc__dolower(const char c)
-{
-	if (c >= 'A' && c <= 'Z')
-		return c + 'a' - 'A';
-	return c;
+	return lwc_error_ok;
 }
 
-static inline lwc_hash
-lwc__calculate_lcase_hash(const char *str, size_t len)
+/**** Iteration ****/
+
+/**
+ * Call a function for every string, optionally including dead ones.
+ *
+ * @return true if any string was found, false otherwise.
+ */
+static bool
+lwc__iterate(lwc_iteration_callback_fn cb, void *pw, bool dead)
 {
-	lwc_hash z = 0x811c9dc5;
+	lwc_hash n;
+	lwc_string *str;
+	bool found;
+
+	found = lwc__shm_iterate(cb, pw);
+	found |= lwc__frozen_iterate(cb, pw);
 
-	while (len > 0) {
-		z *= 0x01000193;
-		z ^= lwc__dolower(*str++);
-		len--;
+	if (ctx == NULL)
+		return found;
+
+	for (n = 0; n < ctx->bucketcount; ++n) {
+		for (str = ctx->buckets[n]; str != NULL; str = STATE_OF(str)->next) {
+			if (dead == false && lwc__string_dead(str))
+				continue;
+			found = true;
+			cb(str, pw);
+		}
 	}
 
-	return z;
+	return found;
 }
 
-static int
-lwc__lcase_strncmp(const char *s1, const char *s2, size_t n)
+/* Every string, as gathered for lwc__with_every_string() */
+typedef struct lwc_every_s {
+	lwc_string **	strs;
+	size_t		n;
+	size_t		space;
+} lwc_every;
+
+static void
+lwc__every_cb(lwc_string *str, void *pw)
 {
-	while (n--) {
-		if (*s1++ != lwc__dolower(*s2++))
-			/** @todo Test this somehow? */
-			return 1;
+	lwc_every *every = pw;
+
+	if (every->strs == NULL)
+		every->space++;
+	else if (every->n < every->space)
+		every->strs[every->n++] = str;
+}
+
+lwc_error
+lwc__with_every_string(lwc_every_fn fn, void *pw)
+{
+	lwc_every every = { NULL, 0, 0 };
+	lwc_error err;
+
+	LWC_LOCK();
+
+	err = lwc__close_caseless();
+	if (err == lwc_error_ok) {
+		(void) lwc__iterate(lwc__every_cb, &every, false);
+		if (every.space > 0) {
+			every.strs = LWC_ALLOC(sizeof(lwc_string *) *
+					every.space);
+			if (every.strs == NULL)
+				err = lwc_error_oom;
+			else
+				(void) lwc__iterate(lwc__every_cb, &every,
+						false);
+		}
 	}
-	return 0;
+
+	if (err == lwc_error_ok)
+		err = fn(every.strs, every.n, pw);
+
+	if (every.strs != NULL)
+		LWC_FREE(every.strs, sizeof(lwc_string *) * every.space);
+
+	LWC_UNLOCK();
+
+	return err;
 }
 
-static void *
-lwc__lcase_memcpy(void *restrict _target, const void *restrict _source, size_t n)
+void
+lwc_iterate_strings(lwc_iteration_callback_fn cb, void *pw)
 {
-	char *restrict target = _target;
-	const char *restrict source = _source;
+	LWC_LOCK();
 
-	while (n--) {
-		*target++ = lwc__dolower(*source++);
+	/* Strings only kept alive by dead ones aren't interesting */
+	lwc__collect();
+
+	if (lwc__iterate(cb, pw, false) == false &&
+			ctx != NULL && ctx->count == 0) {
+		/* We found no strings, so remove the global context. */
+		lwc__finalise();
 	}
 
-	return _target;
+	LWC_UNLOCK();
 }
 
-lwc_error
-lwc__intern_caseless_string(lwc_string *str)
+/* State for finding strings by prefix without the index */
+typedef struct lwc_prefix_scan_s {
+	const char *			prefix;
+	size_t				plen;
+	lwc_iteration_callback_fn	cb;
+	void *				pw;
+} lwc_prefix_scan;
+
+static void
+lwc__prefix_scan_cb(lwc_string *str, void *pw)
 {
-	assert(str);
-	assert(str->insensitive == NULL);
+	lwc_prefix_scan *scan = pw;
 
-	return lwc__intern(CSTR_OF(str),
-			   str->len, &(str->insensitive),
-			   lwc__calculate_lcase_hash,
-			   lwc__lcase_strncmp,
-			   lwc__lcase_memcpy);
+	if (str->len >= scan->plen &&
+			memcmp(CSTR_OF(str), scan->prefix, scan->plen) == 0)
+		scan->cb(str, scan->pw);
 }
 
-/**** Iteration ****/
+static void
+lwc__prefix_build_cb(lwc_string *str, void *pw)
+{
+	lwc_error *err = pw;
+
+	if (*err == lwc_error_ok)
+		*err = lwc__prefix_insert(ctx->prefixes, str);
+}
 
 void
-lwc_iterate_strings(lwc_iteration_callback_fn cb, void *pw)
+lwc_iterate_prefix(const char *prefix, size_t plen,
+		   lwc_iteration_callback_fn cb, void *pw)
 {
-	lwc_hash n;
-	lwc_string *str;
-	bool found = false;
+	lwc_prefix_scan scan;
 
-	if (ctx == NULL)
-		return;
+	assert((prefix != NULL) || (plen == 0));
 
-	for (n = 0; n < ctx->bucketcount; ++n) {
-		for (str = ctx->buckets[n]; str != NULL; str = str->next) {
-			found = true;
-			cb(str, pw);
+	LWC_LOCK();
+
+	if (ctx == NULL) {
+		/* Shared strings still need somewhere to keep the index */
+		if (lwc__shm_attached() == false ||
+				lwc__initialise() != lwc_error_ok) {
+			LWC_UNLOCK();
+			return;
 		}
 	}
 
-	if (found == false) {
-		/* We found no strings, so remove the global context. */
-		free(ctx->buckets);
-		free(ctx);
-		ctx = NULL;
+	if (ctx->prefixes == NULL) {
+		/* Build the index on first use; from then on it is
+		 * maintained as strings come and go. */
+		ctx->prefixes = lwc__prefix_create();
+
+		if (ctx->prefixes != NULL) {
+			lwc_error err = lwc_error_ok;
+
+			/* Dead strings may yet be brought back, so they
+			 * have to be indexed too. */
+			lwc__iterate(lwc__prefix_build_cb, &err, true);
+			if (err != lwc_error_ok) {
+				lwc__prefix_destroy(ctx->prefixes);
+				ctx->prefixes = NULL;
+			}
+		}
+	}
+
+	if (ctx->prefixes != NULL) {
+		lwc__prefix_iterate(ctx->prefixes, prefix, plen, cb, pw);
+	} else {
+		/* No memory for the index, so fall back to a full scan */
+		scan.prefix = prefix;
+		scan.plen = plen;
+		scan.cb = cb;
+		scan.pw = pw;
+		lwc__iterate(lwc__prefix_scan_cb, &scan, false);
 	}
+
+	LWC_UNLOCK();
 }
@@ -0,0 +1,397 @@
+/* prefix.c
+ *
+ * Prefix index over interned strings.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "prefix.h"
+
+/*
+ * Keys can be as long as any interned string, so the trie can be that
+ * deep.  Nodes know their parent, which lets every walk over the trie
+ * loop rather than recurse, and so never run out of stack.
+ */
+struct lwc_prefix_node_s {
+	lwc_prefix_node *	parent;
+	lwc_string *		str;
+	lwc_prefix_node **	children;
+	unsigned int		nchildren;
+	unsigned int		size;
+	size_t			labellen;
+	size_t			labelspace;
+	/* Label bytes follow */
+};
+
+#define LABEL_OF(node) ((char *)((node) + 1))
+
+static lwc_prefix_node *
+lwc__prefix_node_create(const char *label, size_t labellen)
+{
+	lwc_prefix_node *node = LWC_ALLOC(sizeof(*node) + labellen);
+
+	if (node == NULL)
+		return NULL;
+
+	node->parent = NULL;
+	node->str = NULL;
+	node->children = NULL;
+	node->nchildren = 0;
+	node->size = 0;
+	node->labellen = labellen;
+	node->labelspace = labellen;
+	memcpy(LABEL_OF(node), label, labellen);
+
+	return node;
+}
+
+static void
+lwc__prefix_node_free(lwc_prefix_node *node)
+{
+	if (node->children != NULL)
+		LWC_FREE(node->children,
+			 sizeof(lwc_prefix_node *) * node->size);
+	LWC_FREE(node, sizeof(*node) + node->labelspace);
+}
+
+/**
+ * Find the child of a node whose label starts with a given byte.
+ *
+ * @param node The node to search.
+ * @param c    The byte to look for.
+ * @param pos  Filled out with the index the child is, or would be, at.
+ * @return true if the child exists, false otherwise.
+ */
+static bool
+lwc__prefix_find(const lwc_prefix_node *node, char c, unsigned int *pos)
+{
+	unsigned int lo = 0, hi = node->nchildren;
+	unsigned char want = (unsigned char) c;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		unsigned char have = (unsigned char) LABEL_OF(node->children[mid])[0];
+
+		if (have == want) {
+			*pos = mid;
+			return true;
+		} else if (have < want) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	*pos = lo;
+	return false;
+}
+
+/**
+ * Find where a node is among its parent's children.
+ */
+static unsigned int
+lwc__prefix_position(const lwc_prefix_node *node)
+{
+	unsigned int pos = 0;
+	bool found;
+
+	found = lwc__prefix_find(node->parent, LABEL_OF(node)[0], &pos);
+	assert(found && node->parent->children[pos] == node);
+	(void) found;
+
+	return pos;
+}
+
+static lwc_error
+lwc__prefix_add_child(lwc_prefix_node *node, unsigned int pos,
+		lwc_prefix_node *child)
+{
+	if (node->nchildren == node->size) {
+		unsigned int size = (node->size == 0) ? 2 : node->size * 2;
+		lwc_prefix_node **children;
+
+		children = LWC_ALLOC(sizeof(lwc_prefix_node *) * size);
+		if (children == NULL)
+			return lwc_error_oom;
+
+		if (node->children != NULL) {
+			memcpy(children, node->children,
+			       sizeof(lwc_prefix_node *) * node->nchildren);
+			LWC_FREE(node->children,
+				 sizeof(lwc_prefix_node *) * node->size);
+		}
+
+		node->children = children;
+		node->size = size;
+	}
+
+	memmove(&node->children[pos + 1], &node->children[pos],
+		sizeof(lwc_prefix_node *) * (node->nchildren - pos));
+	node->children[pos] = child;
+	node->nchildren++;
+	child->parent = node;
+
+	return lwc_error_ok;
+}
+
+static size_t
+lwc__prefix_common(const char *a, size_t alen, const char *b, size_t blen)
+{
+	size_t n = (alen < blen) ? alen : blen;
+	size_t l = 0;
+
+	while (l < n && a[l] == b[l])
+		l++;
+
+	return l;
+}
+
+lwc_prefix_node *
+lwc__prefix_create(void)
+{
+	return lwc__prefix_node_create("", 0);
+}
+
+void
+lwc__prefix_destroy(lwc_prefix_node *root)
+{
+	lwc_prefix_node *node = root;
+
+	/* Take children off the end until a node has none, free it and
+	 * go back up */
+	for (;;) {
+		lwc_prefix_node *parent;
+
+		if (node->nchildren > 0) {
+			node = node->children[--node->nchildren];
+			continue;
+		}
+
+		parent = node->parent;
+		lwc__prefix_node_free(node);
+		if (node == root)
+			break;
+		node = parent;
+	}
+}
+
+lwc_error
+lwc__prefix_insert(lwc_prefix_node *root, lwc_string *str)
+{
+	lwc_prefix_node *node = root;
+	const char *key = CSTR_OF(str);
+	size_t len = str->len;
+
+	while (len > 0) {
+		lwc_prefix_node *child;
+		unsigned int pos;
+		size_t l;
+
+		if (lwc__prefix_find(node, key[0], &pos) == false) {
+			child = lwc__prefix_node_create(key, len);
+			if (child == NULL)
+				return lwc_error_oom;
+
+			if (lwc__prefix_add_child(node, pos, child) !=
+					lwc_error_ok) {
+				lwc__prefix_node_free(child);
+				return lwc_error_oom;
+			}
+
+			child->str = str;
+			return lwc_error_ok;
+		}
+
+		child = node->children[pos];
+		l = lwc__prefix_common(LABEL_OF(child), child->labellen,
+				key, len);
+
+		if (l < child->labellen) {
+			/* Split the child's label where we diverge */
+			lwc_prefix_node *mid = lwc__prefix_node_create(key, l);
+			if (mid == NULL)
+				return lwc_error_oom;
+
+			if (lwc__prefix_add_child(mid, 0, child) !=
+					lwc_error_ok) {
+				lwc__prefix_node_free(mid);
+				return lwc_error_oom;
+			}
+
+			memmove(LABEL_OF(child), LABEL_OF(child) + l,
+				child->labellen - l);
+			child->labellen -= l;
+			node->children[pos] = mid;
+			mid->parent = node;
+			child = mid;
+		}
+
+		node = child;
+		key += l;
+		len -= l;
+	}
+
+	node->str = str;
+
+	return lwc_error_ok;
+}
+
+/**
+ * Keep the child of a node compact after a removal beneath it.
+ *
+ * Children with nothing left in them are dropped, and children holding
+ * no string with only one child of their own are merged with it.
+ */
+static void
+lwc__prefix_tidy(lwc_prefix_node *node, unsigned int pos)
+{
+	lwc_prefix_node *child = node->children[pos];
+	lwc_prefix_node *grandchild, *merged;
+	unsigned int n;
+
+	if (child->str != NULL || child->nchildren > 1)
+		return;
+
+	if (child->nchildren == 0) {
+		node->nchildren--;
+		memmove(&node->children[pos], &node->children[pos + 1],
+			sizeof(lwc_prefix_node *) * (node->nchildren - pos));
+		lwc__prefix_node_free(child);
+		return;
+	}
+
+	grandchild = child->children[0];
+	merged = LWC_ALLOC(sizeof(*merged) + child->labellen +
+			grandchild->labellen);
+	if (merged == NULL) {
+		/* Not fatal, we're just a little less compact */
+		return;
+	}
+
+	*merged = *grandchild;
+	merged->parent = node;
+	for (n = 0; n < merged->nchildren; n++)
+		merged->children[n]->parent = merged;
+	merged->labellen = child->labellen + grandchild->labellen;
+	merged->labelspace = merged->labellen;
+	memcpy(LABEL_OF(merged), LABEL_OF(child), child->labellen);
+	memcpy(LABEL_OF(merged) + child->labellen, LABEL_OF(grandchild),
+	       grandchild->labellen);
+
+	node->children[pos] = merged;
+	lwc__prefix_node_free(child);
+	LWC_FREE(grandchild, sizeof(*grandchild) + grandchild->labelspace);
+}
+
+void
+lwc__prefix_remove(lwc_prefix_node *root, lwc_string *str)
+{
+	lwc_prefix_node *node = root;
+	const char *key = CSTR_OF(str);
+	size_t len = str->len;
+
+	while (len > 0) {
+		lwc_prefix_node *child;
+		unsigned int pos;
+
+		if (lwc__prefix_find(node, key[0], &pos) == false)
+			return;
+
+		child = node->children[pos];
+		if (len < child->labellen ||
+				memcmp(LABEL_OF(child), key, child->labellen) != 0)
+			return;
+
+		node = child;
+		key += child->labellen;
+		len -= child->labellen;
+	}
+
+	if (node->str != str)
+		return;
+	node->str = NULL;
+
+	/* Tidy each node on the way back up, which may free it */
+	while (node != root) {
+		lwc_prefix_node *parent = node->parent;
+
+		lwc__prefix_tidy(parent, lwc__prefix_position(node));
+		node = parent;
+	}
+}
+
+/**
+ * Call a callback for every string in the subtrie under a node.
+ *
+ * Walks down to first children, and back up to next siblings.
+ */
+static void
+lwc__prefix_visit(const lwc_prefix_node *top,
+		lwc_iteration_callback_fn cb, void *pw)
+{
+	const lwc_prefix_node *node = top;
+
+	for (;;) {
+		if (node->str != NULL && lwc__string_dead(node->str) == false)
+			cb(node->str, pw);
+
+		if (node->nchildren > 0) {
+			node = node->children[0];
+			continue;
+		}
+
+		for (;;) {
+			const lwc_prefix_node *parent = node->parent;
+			unsigned int pos;
+
+			if (node == top)
+				return;
+
+			pos = lwc__prefix_position(node);
+			if (pos + 1 < parent->nchildren) {
+				node = parent->children[pos + 1];
+				break;
+			}
+			node = parent;
+		}
+	}
+}
+
+void
+lwc__prefix_iterate(lwc_prefix_node *root,
+		const char *prefix, size_t plen,
+		lwc_iteration_callback_fn cb, void *pw)
+{
+	lwc_prefix_node *node = root;
+
+	while (plen > 0) {
+		lwc_prefix_node *child;
+		unsigned int pos;
+		size_t l;
+
+		if (lwc__prefix_find(node, prefix[0], &pos) == false)
+			return;
+
+		child = node->children[pos];
+		l = lwc__prefix_common(LABEL_OF(child), child->labellen,
+				prefix, plen);
+
+		if (l == plen) {
+			/* The prefix ends within this child's label */
+			node = child;
+			break;
+		}
+
+		if (l < child->labellen)
+			return;
+
+		node = child;
+		prefix += l;
+		plen -= l;
+	}
+
+	lwc__prefix_visit(node, cb, pw);
+}
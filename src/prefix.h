@@ -0,0 +1,67 @@
+/* prefix.h
+ *
+ * Prefix index over interned strings.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_prefix_h_
+#define libwapcaplet_prefix_h_
+
+#include "internal.h"
+
+/**
+ * A node in the prefix index.
+ *
+ * The index is a path-compressed radix trie keyed on string content.
+ * Each node carries the run of bytes leading to it from its parent and
+ * at most one string (interned strings are unique by content).
+ */
+typedef struct lwc_prefix_node_s lwc_prefix_node;
+
+/**
+ * Create an empty prefix index.
+ *
+ * @return The root of the new index, or NULL on memory exhaustion.
+ */
+lwc_prefix_node *lwc__prefix_create(void);
+
+/**
+ * Destroy a prefix index.
+ *
+ * @param root The index to destroy.  The strings in it are not touched.
+ */
+void lwc__prefix_destroy(lwc_prefix_node *root);
+
+/**
+ * Add a string to a prefix index.
+ *
+ * @param root The index to add to.
+ * @param str  The string to add.
+ * @return lwc_error_ok on success, lwc_error_oom otherwise.  On failure
+ *	   the index remains consistent but does not contain \a str.
+ */
+lwc_error lwc__prefix_insert(lwc_prefix_node *root, lwc_string *str);
+
+/**
+ * Remove a string from a prefix index.
+ *
+ * @param root The index to remove from.
+ * @param str  The string to remove.  It is fine for it to be absent.
+ */
+void lwc__prefix_remove(lwc_prefix_node *root, lwc_string *str);
+
+/**
+ * Call a callback for every string in an index starting with a prefix.
+ *
+ * @param root	 The index to search.
+ * @param prefix The prefix to look for.
+ * @param plen	 The length of \a prefix.
+ * @param cb	 The callback to give each string to.
+ * @param pw	 The private word for the callback.
+ */
+void lwc__prefix_iterate(lwc_prefix_node *root,
+		const char *prefix, size_t plen,
+		lwc_iteration_callback_fn cb, void *pw);
+
+#endif /* libwapcaplet_prefix_h_ */
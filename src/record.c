@@ -0,0 +1,815 @@
+/* record.c
+ *
+ * Recording calls into libwapcaplet, and replaying them.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef LWC_WITH_THREADS
+#include <pthread.h>
+#endif
+
+#include "histogram.h"
+#include "record.h"
+#include "shm.h"
+
+#define RECORD_VERSION	(1)
+
+/* Size of the buffers traces are written and read through */
+#define RECORD_BUFFER_SIZE	(65536)
+
+/*
+ * A trace starts with "LWCR" and a version, after which there is one
+ * record for each call: an opcode, then its operands.  Every number is
+ * unsigned LEB128.
+ *
+ * Strings are referred to by id.  A string is given one when it first
+ * appears in the trace, and once it has been destroyed its id may be
+ * given to another.  Strings which were interned before recording started
+ * are introduced by an ADOPT record before their first use.
+ */
+typedef enum lwc_record_op_e {
+	RECORD_INTERN		= 1,	/* id, length, bytes */
+	RECORD_SUBSTRING	= 2,	/* id, source id, offset, length */
+	RECORD_REF		= 3,	/* id */
+	RECORD_UNREF		= 4,	/* id */
+	RECORD_CASELESS		= 5,	/* id, id */
+	RECORD_TOLOWER		= 6,	/* id, source id */
+	RECORD_ADOPT		= 7	/* id, length, bytes */
+} lwc_record_op;
+
+static const uint8_t lwc__record_magic[4] = { 'L', 'W', 'C', 'R' };
+
+/**** Recording ****/
+
+#ifdef LWC_WITH_RECORD
+
+/* The id of a string interned before recording started, until it is used */
+#define RECORD_ID_ADOPT		(UINT32_MAX)
+
+bool lwc__recording = false;
+
+#ifdef LWC_WITH_THREADS
+static pthread_mutex_t lwc__record_lock = PTHREAD_MUTEX_INITIALIZER;
+#define RECORD_LOCK() pthread_mutex_lock(&lwc__record_lock)
+#define RECORD_UNLOCK() pthread_mutex_unlock(&lwc__record_lock)
+#else
+#define RECORD_LOCK() ((void)0)
+#define RECORD_UNLOCK() ((void)0)
+#endif
+
+/* The trace being written, or -1 */
+static int lwc__record_fd = -1;
+static bool lwc__record_failed;
+static uint8_t lwc__record_buf[RECORD_BUFFER_SIZE];
+static size_t lwc__record_used;
+
+/* Ids handed out so far, and those of strings destroyed since */
+static uint32_t lwc__record_next_id;
+static uint32_t *lwc__record_free_ids;
+static size_t lwc__record_free_count;
+static size_t lwc__record_free_space;
+
+static void
+lwc__record_flush(void)
+{
+	size_t done = 0;
+
+	while (done < lwc__record_used && lwc__record_failed == false) {
+		ssize_t n = write(lwc__record_fd, lwc__record_buf + done,
+				lwc__record_used - done);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			lwc__record_failed = true;
+		else
+			done += n;
+	}
+
+	lwc__record_used = 0;
+}
+
+static void
+lwc__record_uint(uint64_t v)
+{
+	if (lwc__record_used + 10 > RECORD_BUFFER_SIZE)
+		lwc__record_flush();
+
+	while (v >= 0x80) {
+		lwc__record_buf[lwc__record_used++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	lwc__record_buf[lwc__record_used++] = (uint8_t)v;
+}
+
+static void
+lwc__record_bytes(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len > 0) {
+		size_t n = RECORD_BUFFER_SIZE - lwc__record_used;
+
+		if (n == 0) {
+			lwc__record_flush();
+			continue;
+		}
+		if (n > len)
+			n = len;
+
+		memcpy(lwc__record_buf + lwc__record_used, p, n);
+		lwc__record_used += n;
+		p += n;
+		len -= n;
+	}
+}
+
+static void
+lwc__record_string(lwc_record_op op, uint32_t id, const lwc_string *str)
+{
+	lwc__record_uint(op);
+	lwc__record_uint(id);
+	lwc__record_uint(str->len);
+	lwc__record_bytes(CSTR_OF(str), str->len);
+}
+
+static uint32_t
+lwc__record_new_id(void)
+{
+	if (lwc__record_free_count > 0)
+		return lwc__record_free_ids[--lwc__record_free_count];
+
+	return ++lwc__record_next_id;
+}
+
+static void
+lwc__record_release_id(uint32_t id)
+{
+	if (lwc__record_free_count == lwc__record_free_space) {
+		size_t space = lwc__record_free_space * 2 + 256;
+		uint32_t *ids = LWC_ALLOC(sizeof(uint32_t) * space);
+
+		/* Ids are plentiful; this one just won't be used again */
+		if (ids == NULL)
+			return;
+
+		if (lwc__record_free_ids != NULL) {
+			memcpy(ids, lwc__record_free_ids, sizeof(uint32_t) *
+					lwc__record_free_count);
+			LWC_FREE(lwc__record_free_ids, sizeof(uint32_t) *
+					lwc__record_free_space);
+		}
+
+		lwc__record_free_ids = ids;
+		lwc__record_free_space = space;
+	}
+
+	lwc__record_free_ids[lwc__record_free_count++] = id;
+}
+
+/**
+ * Find the id of a string used by a call, introducing the string to the
+ * trace first if it hasn't appeared yet.
+ */
+static uint32_t
+lwc__record_known(lwc_string *str)
+{
+	lwc_string_state *state = STATE_OF(str);
+
+	if (state->record_id == 0 || state->record_id == RECORD_ID_ADOPT) {
+		state->record_id = lwc__record_new_id();
+		lwc__record_string(RECORD_ADOPT, state->record_id, str);
+	}
+
+	return state->record_id;
+}
+
+/**
+ * Find the id of a string returned by a call.
+ *
+ * A string with no id yet was created since recording started, so the
+ * call introduces it.
+ */
+static uint32_t
+lwc__record_result(lwc_string *str)
+{
+	lwc_string_state *state = STATE_OF(str);
+
+	if (state->record_id == RECORD_ID_ADOPT)
+		return lwc__record_known(str);
+
+	if (state->record_id == 0)
+		state->record_id = lwc__record_new_id();
+
+	return state->record_id;
+}
+
+/**
+ * Take the recording lock if a call on a string is to be recorded.
+ *
+ * @return true if the call is to be recorded, with the lock held.
+ */
+static bool
+lwc__record_begin(const lwc_string *str)
+{
+	/* Nothing may be written to shared strings, ids included */
+	if (lwc__shm_contains(str))
+		return false;
+
+	RECORD_LOCK();
+
+	if (lwc__recording)
+		return true;
+
+	RECORD_UNLOCK();
+
+	return false;
+}
+
+void
+lwc__record_intern(lwc_string *str)
+{
+	if (lwc__record_begin(str) == false)
+		return;
+
+	lwc__record_string(RECORD_INTERN, lwc__record_result(str), str);
+
+	RECORD_UNLOCK();
+}
+
+void
+lwc__record_substring(lwc_string *str, lwc_string *src, size_t offset)
+{
+	uint32_t id, src_id;
+
+	if (lwc__record_begin(str) == false)
+		return;
+
+	if (lwc__shm_contains(src)) {
+		/* A shared source never appears, so intern the text */
+		lwc__record_string(RECORD_INTERN, lwc__record_result(str),
+				str);
+	} else {
+		src_id = lwc__record_known(src);
+		id = lwc__record_result(str);
+
+		lwc__record_uint(RECORD_SUBSTRING);
+		lwc__record_uint(id);
+		lwc__record_uint(src_id);
+		lwc__record_uint(offset);
+		lwc__record_uint(str->len);
+	}
+
+	RECORD_UNLOCK();
+}
+
+void
+lwc__record_tolower(lwc_string *str, lwc_string *src)
+{
+	uint32_t id, src_id;
+
+	if (lwc__record_begin(str) == false)
+		return;
+
+	if (lwc__shm_contains(src)) {
+		lwc__record_string(RECORD_INTERN, lwc__record_result(str),
+				str);
+	} else {
+		src_id = lwc__record_known(src);
+		id = lwc__record_result(str);
+
+		lwc__record_uint(RECORD_TOLOWER);
+		lwc__record_uint(id);
+		lwc__record_uint(src_id);
+	}
+
+	RECORD_UNLOCK();
+}
+
+void
+lwc__record_ref(lwc_string *str)
+{
+	uint32_t id;
+
+	if (lwc__record_begin(str) == false)
+		return;
+
+	id = lwc__record_known(str);
+	lwc__record_uint(RECORD_REF);
+	lwc__record_uint(id);
+
+	RECORD_UNLOCK();
+}
+
+void
+lwc__record_unref(lwc_string *str)
+{
+	uint32_t id;
+
+	if (lwc__record_begin(str) == false)
+		return;
+
+	id = lwc__record_known(str);
+	lwc__record_uint(RECORD_UNREF);
+	lwc__record_uint(id);
+
+	RECORD_UNLOCK();
+}
+
+void
+lwc__record_caseless(lwc_string *str1, lwc_string *str2)
+{
+	uint32_t id1, id2;
+
+	if (lwc__shm_contains(str2) || lwc__record_begin(str1) == false)
+		return;
+
+	id1 = lwc__record_known(str1);
+	id2 = lwc__record_known(str2);
+
+	lwc__record_uint(RECORD_CASELESS);
+	lwc__record_uint(id1);
+	lwc__record_uint(id2);
+
+	RECORD_UNLOCK();
+}
+
+void
+lwc__record_forget(lwc_string *str)
+{
+	lwc_string_state *state = STATE_OF(str);
+
+	if (lwc__record_begin(str) == false)
+		return;
+
+	if (state->record_id != 0 && state->record_id != RECORD_ID_ADOPT)
+		lwc__record_release_id(state->record_id);
+	state->record_id = 0;
+
+	RECORD_UNLOCK();
+}
+
+static void
+lwc__record_adopt_cb(lwc_string *str, void *pw)
+{
+	UNUSED(pw);
+
+	if (lwc__shm_contains(str) == false)
+		STATE_OF(str)->record_id = RECORD_ID_ADOPT;
+}
+
+lwc_error
+lwc_record_start(int fd)
+{
+	RECORD_LOCK();
+	if (lwc__record_fd != -1) {
+		RECORD_UNLOCK();
+		return lwc_error_busy;
+	}
+	lwc__record_fd = fd;
+	RECORD_UNLOCK();
+
+	/* Ids from any earlier trace mean nothing in this one.  Strings
+	 * may be freed as we go, which takes the recording lock. */
+	lwc_iterate_strings(lwc__record_adopt_cb, NULL);
+
+	RECORD_LOCK();
+	lwc__record_failed = false;
+	lwc__record_used = 0;
+	lwc__record_next_id = 0;
+	lwc__record_bytes(lwc__record_magic, sizeof(lwc__record_magic));
+	lwc__record_uint(RECORD_VERSION);
+	LWC_STORE_RELEASE(&lwc__recording, true);
+	RECORD_UNLOCK();
+
+	return lwc_error_ok;
+}
+
+lwc_error
+lwc_record_stop(void)
+{
+	bool failed;
+
+	RECORD_LOCK();
+	if (lwc__recording == false) {
+		RECORD_UNLOCK();
+		return lwc_error_invalid;
+	}
+
+	LWC_STORE_RELEASE(&lwc__recording, false);
+	lwc__record_flush();
+	failed = lwc__record_failed;
+
+	if (lwc__record_free_ids != NULL)
+		LWC_FREE(lwc__record_free_ids, sizeof(uint32_t) *
+				lwc__record_free_space);
+	lwc__record_free_ids = NULL;
+	lwc__record_free_count = 0;
+	lwc__record_free_space = 0;
+	lwc__record_fd = -1;
+	RECORD_UNLOCK();
+
+	return failed ? lwc_error_io : lwc_error_ok;
+}
+
+#else
+
+lwc_error
+lwc_record_start(int fd)
+{
+	UNUSED(fd);
+
+	return lwc_error_unsupported;
+}
+
+lwc_error
+lwc_record_stop(void)
+{
+	return lwc_error_unsupported;
+}
+
+#endif
+
+/**** Replaying ****/
+
+/* A string the trace refers to */
+typedef struct lwc_replay_slot_s {
+	lwc_string *	str;
+	uint32_t	held;		/**< References the replay holds */
+	bool		adopted;	/**< One was never the trace's */
+} lwc_replay_slot;
+
+typedef struct lwc_replayer_s {
+	int			fd;
+	size_t			used;		/**< Bytes of buf read */
+	size_t			avail;		/**< Bytes in buf */
+	uint8_t			buf[RECORD_BUFFER_SIZE];
+	char *			text;		/**< Text of a string */
+	size_t			text_space;
+	lwc_replay_slot *	slots;		/**< Strings, by id */
+	size_t			nslots;
+	uint64_t		max[LWC_REPLAY_STATS_SIZE];
+	uint64_t		hist[LWC_REPLAY_STATS_SIZE]
+					[LWC_HISTOGRAM_BUCKETS];
+} lwc_replayer;
+
+static void
+lwc__replay_time(lwc_replayer *r, lwc_replay_stats *stats, lwc_replay_op op,
+		 uint64_t start)
+{
+	uint64_t ns = lwc__now() - start;
+	unsigned int bucket = lwc__histogram_bucket(ns);
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		int which = (i == 0) ? (int)op : lwc_replay_op_count;
+
+		stats[which].calls++;
+		stats[which].elapsed += ns;
+		r->hist[which][bucket]++;
+		if (ns > r->max[which])
+			r->max[which] = ns;
+	}
+}
+
+static bool
+lwc__replay_byte(lwc_replayer *r, uint8_t *b)
+{
+	if (r->used == r->avail) {
+		ssize_t n;
+
+		do {
+			n = read(r->fd, r->buf, sizeof(r->buf));
+		} while (n < 0 && errno == EINTR);
+
+		if (n <= 0)
+			return false;
+
+		r->used = 0;
+		r->avail = n;
+	}
+
+	*b = r->buf[r->used++];
+
+	return true;
+}
+
+static bool
+lwc__replay_uint(lwc_replayer *r, uint64_t *v)
+{
+	unsigned int shift = 0;
+	uint8_t b;
+
+	*v = 0;
+	do {
+		if (shift > 63 || lwc__replay_byte(r, &b) == false)
+			return false;
+		*v |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+
+	return true;
+}
+
+/**
+ * Read the text of a string into the replay's buffer.
+ */
+static lwc_error
+lwc__replay_text(lwc_replayer *r, uint64_t *len)
+{
+	uint64_t i;
+
+	if (lwc__replay_uint(r, len) == false || *len > SIZE_MAX - 1)
+		return lwc_error_invalid;
+
+	if (*len > r->text_space) {
+		char *text = malloc(*len);
+
+		if (text == NULL)
+			return lwc_error_oom;
+		free(r->text);
+		r->text = text;
+		r->text_space = *len;
+	}
+
+	for (i = 0; i < *len; i++) {
+		uint8_t b;
+
+		if (lwc__replay_byte(r, &b) == false)
+			return lwc_error_invalid;
+		r->text[i] = (char)b;
+	}
+
+	return lwc_error_ok;
+}
+
+/**
+ * Find the string with an id, if it is still alive.
+ */
+static lwc_replay_slot *
+lwc__replay_find(lwc_replayer *r, uint64_t id)
+{
+	if (id >= r->nslots || r->slots[id].str == NULL)
+		return NULL;
+
+	return &r->slots[id];
+}
+
+static void
+lwc__replay_release(lwc_replay_slot *slot)
+{
+	for (; slot->held > 0; slot->held--)
+		lwc_string_unref(slot->str);
+
+	slot->str = NULL;
+	slot->adopted = false;
+}
+
+/**
+ * Take charge of a reference returned by a call, under the id the trace
+ * gave it.
+ */
+static lwc_error
+lwc__replay_define(lwc_replayer *r, uint64_t id, lwc_string *str,
+		   bool adopted)
+{
+	lwc_replay_slot *slot;
+
+	if (id >= r->nslots) {
+		size_t n = r->nslots * 2 + 1024;
+		lwc_replay_slot *slots;
+
+		if (id >= UINT32_MAX) {
+			lwc_string_unref(str);
+			return lwc_error_invalid;
+		}
+
+		while (n <= id)
+			n *= 2;
+
+		slots = malloc(sizeof(lwc_replay_slot) * n);
+		if (slots == NULL) {
+			lwc_string_unref(str);
+			return lwc_error_oom;
+		}
+
+		memset(slots, 0, sizeof(lwc_replay_slot) * n);
+		if (r->slots != NULL) {
+			memcpy(slots, r->slots,
+					sizeof(lwc_replay_slot) * r->nslots);
+			free(r->slots);
+		}
+
+		r->slots = slots;
+		r->nslots = n;
+	}
+
+	slot = &r->slots[id];
+
+	/* Whatever had the id before has been destroyed where the trace
+	 * was recorded */
+	if (slot->str != str) {
+		lwc__replay_release(slot);
+		slot->str = str;
+	}
+
+	slot->held++;
+	if (adopted)
+		slot->adopted = true;
+
+	return lwc_error_ok;
+}
+
+/**
+ * Replay one call.
+ *
+ * @return lwc_error_ok on success, lwc_error_range at the end of the
+ *	   trace, or another error if the replay can't go on.
+ */
+static lwc_error
+lwc__replay_step(lwc_replayer *r, lwc_replay_stats *stats)
+{
+	lwc_replay_slot *slot, *other;
+	uint64_t id, src, offset, len;
+	lwc_string *str;
+	lwc_error err;
+	uint64_t start;
+	uint8_t op;
+	bool equal;
+
+	if (lwc__replay_byte(r, &op) == false)
+		return lwc_error_range;
+
+	switch (op) {
+	case RECORD_INTERN:
+	case RECORD_ADOPT:
+		if (lwc__replay_uint(r, &id) == false)
+			return lwc_error_invalid;
+		err = lwc__replay_text(r, &len);
+		if (err != lwc_error_ok)
+			return err;
+
+		start = lwc__now();
+		err = lwc_intern_string(r->text, len, &str);
+		if (err != lwc_error_ok)
+			return err;
+		if (op == RECORD_INTERN)
+			lwc__replay_time(r, stats, lwc_replay_intern, start);
+
+		return lwc__replay_define(r, id, str, op == RECORD_ADOPT);
+
+	case RECORD_SUBSTRING:
+		if (lwc__replay_uint(r, &id) == false ||
+				lwc__replay_uint(r, &src) == false ||
+				lwc__replay_uint(r, &offset) == false ||
+				lwc__replay_uint(r, &len) == false)
+			return lwc_error_invalid;
+
+		slot = lwc__replay_find(r, src);
+		if (slot == NULL)
+			return lwc_error_ok;
+
+		start = lwc__now();
+		err = lwc_intern_substring(slot->str, offset, len, &str);
+		if (err != lwc_error_ok)
+			return lwc_error_invalid;
+		lwc__replay_time(r, stats, lwc_replay_substring, start);
+
+		return lwc__replay_define(r, id, str, false);
+
+	case RECORD_TOLOWER:
+		if (lwc__replay_uint(r, &id) == false ||
+				lwc__replay_uint(r, &src) == false)
+			return lwc_error_invalid;
+
+		slot = lwc__replay_find(r, src);
+		if (slot == NULL)
+			return lwc_error_ok;
+
+		start = lwc__now();
+		err = lwc_string_tolower(slot->str, &str);
+		if (err != lwc_error_ok)
+			return err;
+		lwc__replay_time(r, stats, lwc_replay_tolower, start);
+
+		return lwc__replay_define(r, id, str, false);
+
+	case RECORD_REF:
+		if (lwc__replay_uint(r, &id) == false)
+			return lwc_error_invalid;
+
+		slot = lwc__replay_find(r, id);
+		if (slot == NULL)
+			return lwc_error_ok;
+
+		start = lwc__now();
+		(void) lwc_string_ref(slot->str);
+		lwc__replay_time(r, stats, lwc_replay_ref, start);
+		slot->held++;
+
+		return lwc_error_ok;
+
+	case RECORD_UNREF:
+		if (lwc__replay_uint(r, &id) == false)
+			return lwc_error_invalid;
+
+		/* References to adopted strings which were taken before
+		 * recording started are not ours to release */
+		slot = lwc__replay_find(r, id);
+		if (slot == NULL || slot->held <= (slot->adopted ? 1 : 0))
+			return lwc_error_ok;
+
+		start = lwc__now();
+		lwc_string_unref(slot->str);
+		lwc__replay_time(r, stats, lwc_replay_unref, start);
+		if (--slot->held == 0)
+			slot->str = NULL;
+
+		return lwc_error_ok;
+
+	case RECORD_CASELESS:
+		if (lwc__replay_uint(r, &id) == false ||
+				lwc__replay_uint(r, &src) == false)
+			return lwc_error_invalid;
+
+		slot = lwc__replay_find(r, id);
+		other = lwc__replay_find(r, src);
+		if (slot == NULL || other == NULL)
+			return lwc_error_ok;
+
+		start = lwc__now();
+		(void) lwc_string_caseless_isequal(slot->str, other->str,
+				&equal);
+		lwc__replay_time(r, stats, lwc_replay_caseless, start);
+
+		return lwc_error_ok;
+	}
+
+	return lwc_error_invalid;
+}
+
+lwc_error
+lwc_replay(int fd, lwc_replay_stats stats[LWC_REPLAY_STATS_SIZE])
+{
+	lwc_replayer *r;
+	lwc_error err = lwc_error_ok;
+	uint64_t version;
+	size_t i;
+	int which;
+
+	assert(stats);
+
+	memset(stats, 0, sizeof(lwc_replay_stats) * LWC_REPLAY_STATS_SIZE);
+
+	/* The replay's own state comes from malloc(), so the allocator
+	 * given to lwc_set_allocator() sees only libwapcaplet's memory */
+	r = malloc(sizeof(lwc_replayer));
+	if (r == NULL)
+		return lwc_error_oom;
+
+	memset(r, 0, sizeof(lwc_replayer));
+	r->fd = fd;
+
+	for (i = 0; i < sizeof(lwc__record_magic); i++) {
+		uint8_t b;
+
+		if (lwc__replay_byte(r, &b) == false ||
+				b != lwc__record_magic[i])
+			err = lwc_error_invalid;
+	}
+
+	if (err == lwc_error_ok && (lwc__replay_uint(r, &version) == false ||
+			version != RECORD_VERSION))
+		err = lwc_error_invalid;
+
+	while (err == lwc_error_ok)
+		err = lwc__replay_step(r, stats);
+
+	if (err == lwc_error_range)
+		err = lwc_error_ok;
+
+	for (which = 0; which < LWC_REPLAY_STATS_SIZE; which++) {
+		const uint64_t *hist = r->hist[which];
+		uint64_t max = r->max[which];
+
+		stats[which].p50 = lwc__histogram_percentile(hist, max, 50);
+		stats[which].p90 = lwc__histogram_percentile(hist, max, 90);
+		stats[which].p99 = lwc__histogram_percentile(hist, max, 99);
+		stats[which].max = max;
+	}
+
+	for (i = 0; i < r->nslots; i++)
+		lwc__replay_release(&r->slots[i]);
+
+	free(r->slots);
+	free(r->text);
+	free(r);
+
+	return err;
+}
@@ -0,0 +1,27 @@
+/* record.h
+ *
+ * Recording calls into libwapcaplet.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_record_h_
+#define libwapcaplet_record_h_
+
+#include "internal.h"
+
+#ifdef LWC_WITH_RECORD
+
+/*
+ * These are called through LWC__RECORD() once the call they record has
+ * succeeded, except lwc__record_forget(), which is called as a string is
+ * freed so that its id may be given to another.
+ */
+void lwc__record_intern(lwc_string *str);
+void lwc__record_substring(lwc_string *str, lwc_string *src, size_t offset);
+void lwc__record_tolower(lwc_string *str, lwc_string *src);
+void lwc__record_forget(lwc_string *str);
+
+#endif
+
+#endif /* libwapcaplet_record_h_ */
@@ -0,0 +1,431 @@
+/* shm.c
+ *
+ * Intern tables shared between processes.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <string.h>
+
+#include "shm.h"
+
+#ifdef LWC_WITH_SHM
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_MAGIC	(0x4c574353u)	/* "LWCS" */
+#define SHM_VERSION	(4)
+
+#define SHM_ALIGN(n) (((n) + 7) & ~((size_t)7))
+
+/**
+ * Header at the start of a shared segment.
+ */
+typedef struct lwc_shm_header_s {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	string_size;	/**< sizeof(lwc_string) of publisher */
+	uint32_t	hash_size;	/**< sizeof(lwc_hash) of publisher */
+	uint64_t	size;		/**< Size of the segment in bytes */
+	uint64_t	base;		/**< Address the publisher mapped it at */
+	uint64_t	key[2];		/**< Publisher's hash key */
+	uint64_t	seed;		/**< Publisher's hash seed */
+	uint64_t	count;		/**< Number of strings */
+	uint64_t	bucketcount;	/**< Number of buckets */
+	uint64_t	buckets;	/**< Offset of bucket array */
+} lwc_shm_header;
+
+const char *lwc__shm_base = NULL;
+const uint64_t *lwc__shm_buckets = NULL;
+uint64_t lwc__shm_bucketcount = 0;
+uint64_t lwc__shm_size = 0;
+
+bool
+lwc__shm_iterate(lwc_iteration_callback_fn cb, void *pw)
+{
+	bool found = false;
+	uint64_t n;
+
+	if (lwc__shm_base == NULL)
+		return false;
+
+	for (n = 0; n < lwc__shm_bucketcount; n++) {
+		lwc_string *str;
+
+		for (str = lwc__shm_record_string(lwc__shm_buckets[n]);
+				str != NULL; str = lwc__shm_next(str)) {
+			found = true;
+			cb(str, pw);
+		}
+	}
+
+	return found;
+}
+
+/**** Publishing ****/
+
+/* A string to publish and where it goes in the segment */
+typedef struct lwc_shm_entry_s {
+	lwc_string *	str;
+	uint64_t	offset;
+} lwc_shm_entry;
+
+typedef struct lwc_shm_collection_s {
+	lwc_shm_entry *	entries;
+	size_t		count;
+} lwc_shm_collection;
+
+static void
+lwc__shm_release(lwc_shm_collection *c)
+{
+	if (c->entries != NULL)
+		LWC_FREE(c->entries, sizeof(lwc_shm_entry) * c->count);
+	c->entries = NULL;
+	c->count = 0;
+}
+
+static int
+lwc__shm_entry_cmp(const void *a, const void *b)
+{
+	uintptr_t sa = (uintptr_t)((const lwc_shm_entry *)a)->str;
+	uintptr_t sb = (uintptr_t)((const lwc_shm_entry *)b)->str;
+
+	return (sa > sb) - (sa < sb);
+}
+
+static uint64_t
+lwc__shm_offset_of(const lwc_shm_collection *c, lwc_string *str)
+{
+	lwc_shm_entry key, *found;
+
+	key.str = str;
+	found = bsearch(&key, c->entries, c->count, sizeof(lwc_shm_entry),
+			lwc__shm_entry_cmp);
+	assert(found != NULL);
+
+	return found->offset;
+}
+
+/**
+ * Write a segment holding every string, with the table locked.
+ *
+ * The strings are closed under caseless interning, so that nobody ever
+ * has to write a shared string's insensitive link.
+ */
+static lwc_error
+lwc__shm_write(lwc_string **strs, size_t n, void *pw)
+{
+	int fd = *(int *)pw;
+	lwc_shm_collection c;
+	lwc_shm_header *hdr;
+	uint64_t *buckets;
+	char *base;
+	size_t size, i;
+
+	c.count = n;
+	c.entries = NULL;
+	if (n > 0) {
+		c.entries = LWC_ALLOC(sizeof(lwc_shm_entry) * n);
+		if (c.entries == NULL)
+			return lwc_error_oom;
+	}
+
+	for (i = 0; i < n; i++) {
+		c.entries[i].str = strs[i];
+		c.entries[i].offset = 0;
+	}
+
+	qsort(c.entries, c.count, sizeof(lwc_shm_entry), lwc__shm_entry_cmp);
+
+	/* Lay the segment out */
+	size = SHM_ALIGN(sizeof(lwc_shm_header));
+	size += sizeof(uint64_t) * (c.count | 1);
+	for (i = 0; i < c.count; i++) {
+		c.entries[i].offset = size;
+		size += SHM_ALIGN(sizeof(lwc_shm_record) +
+				c.entries[i].str->len + 1);
+	}
+
+	if (ftruncate(fd, size) != 0) {
+		lwc__shm_release(&c);
+		return lwc_error_oom;
+	}
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		lwc__shm_release(&c);
+		return lwc_error_oom;
+	}
+
+	memset(base, 0, size);
+
+	hdr = (lwc_shm_header *)(void *)base;
+	hdr->magic = SHM_MAGIC;
+	hdr->version = SHM_VERSION;
+	hdr->string_size = sizeof(lwc_string);
+	hdr->hash_size = sizeof(lwc_hash);
+	hdr->size = size;
+	hdr->base = (uintptr_t)base;
+	hdr->key[0] = lwc__key[0];
+	hdr->key[1] = lwc__key[1];
+	hdr->seed = lwc__seed;
+	hdr->count = c.count;
+	hdr->bucketcount = c.count | 1;
+	hdr->buckets = SHM_ALIGN(sizeof(lwc_shm_header));
+
+	buckets = (uint64_t *)(void *)(base + hdr->buckets);
+
+	for (i = 0; i < c.count; i++) {
+		lwc_string *str = c.entries[i].str;
+		lwc_shm_record *rec = (lwc_shm_record *)(void *)
+				(base + c.entries[i].offset);
+		uint64_t bucket = str->hash % hdr->bucketcount;
+		lwc_string_state *state;
+
+		rec->next = buckets[bucket];
+		buckets[bucket] = c.entries[i].offset;
+
+#ifdef LWC_SPLIT_LAYOUT
+		rec->str.state = &rec->state;
+#endif
+		state = STATE_OF(&rec->str);
+
+		state->prevptr = NULL;
+		state->next = NULL;
+		rec->str.len = str->len;
+		rec->str.hash = str->hash;
+		rec->str.chash = str->chash;
+		/* Never counted, so that no process writes to it */
+#ifdef LWC_WITH_THREADS
+		state->refcnt = 0;
+		state->owner = LWC__OWNER_STATIC;
+		state->shared = LWC__SHARED_ONE | LWC__SHARED_MERGED;
+		state->queued = NULL;
+#else
+		state->refcnt = LWC__REFCNT_STATIC;
+#endif
+		rec->insensitive = lwc__shm_offset_of(&c,
+				lwc__string_insensitive(str));
+
+		memcpy(STR_OF(&rec->str), CSTR_OF(str), str->len);
+		STR_OF(&rec->str)[str->len] = '\0';
+	}
+
+	munmap(base, size);
+	lwc__shm_release(&c);
+
+	return lwc_error_ok;
+}
+
+lwc_error
+lwc_shm_publish(int fd)
+{
+	return lwc__with_every_string(lwc__shm_write, &fd);
+}
+
+/**** Attaching ****/
+
+/**
+ * Find out whether a record lies wholly within a segment.
+ *
+ * Records follow the bucket array, and each is aligned and has room
+ * for its string's bytes and terminator before the end of the segment.
+ */
+static bool
+lwc__shm_record_valid(const char *base, const lwc_shm_header *hdr,
+		uint64_t offset)
+{
+	const lwc_shm_record *rec;
+
+	if (offset < hdr->buckets + hdr->bucketcount * sizeof(uint64_t) ||
+			offset % sizeof(uint64_t) != 0 ||
+			offset > hdr->size ||
+			hdr->size - offset < sizeof(lwc_shm_record))
+		return false;
+
+	rec = (const lwc_shm_record *)(const void *)(base + offset);
+
+	return rec->str.len < hdr->size - offset - sizeof(lwc_shm_record);
+}
+
+/**
+ * Check every chain in a segment before anything follows them.
+ *
+ * The publisher places each record after the one it links to, so the
+ * offsets in a chain must fall, which also means it can't loop.  Every
+ * string must be one nobody counts, and its caseless form a record too,
+ * linked by offset alone.
+ */
+static bool
+lwc__shm_valid(const char *base, const lwc_shm_header *hdr)
+{
+	const uint64_t *buckets = (const uint64_t *)(const void *)
+			(base + hdr->buckets);
+	uint64_t n;
+
+	for (n = 0; n < hdr->bucketcount; n++) {
+		uint64_t offset = buckets[n], limit = hdr->size;
+
+		while (offset != 0) {
+			const lwc_shm_record *rec;
+			const lwc_string_state *state;
+
+			if (offset >= limit || lwc__shm_record_valid(base,
+					hdr, offset) == false)
+				return false;
+
+			rec = (const lwc_shm_record *)(const void *)
+					(base + offset);
+#ifdef LWC_SPLIT_LAYOUT
+			if ((uint64_t)(uintptr_t)rec->str.state != hdr->base +
+					offset + offsetof(lwc_shm_record, state))
+				return false;
+			state = &rec->state;
+#else
+			state = &rec->str.state;
+#endif
+
+#ifdef LWC_WITH_THREADS
+			if (state->owner != LWC__OWNER_STATIC)
+				return false;
+#else
+			if (state->refcnt != LWC__REFCNT_STATIC)
+				return false;
+#endif
+
+			if (state->insensitive != NULL ||
+					lwc__shm_record_valid(base, hdr,
+						rec->insensitive) == false)
+				return false;
+
+			limit = offset;
+			offset = rec->next;
+		}
+	}
+
+	return true;
+}
+
+lwc_error
+lwc_shm_attach(int fd)
+{
+	lwc_shm_header hdr;
+	struct stat st;
+	char *base;
+	int flags = MAP_SHARED;
+	lwc_error result = lwc_error_ok;
+
+	if (lwc__shm_base != NULL || lwc__has_strings())
+		return lwc_error_busy;
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+			fstat(fd, &st) != 0)
+		return lwc_error_invalid;
+
+	if (hdr.magic != SHM_MAGIC || hdr.version != SHM_VERSION ||
+			hdr.string_size != sizeof(lwc_string) ||
+			hdr.hash_size != sizeof(lwc_hash) ||
+			hdr.size > (uint64_t)st.st_size ||
+			hdr.size > SIZE_MAX ||
+			hdr.buckets > hdr.size ||
+			hdr.buckets % sizeof(uint64_t) != 0 ||
+			hdr.bucketcount > (hdr.size - hdr.buckets) /
+				sizeof(uint64_t) ||
+			hdr.bucketcount == 0)
+		return lwc_error_invalid;
+
+#ifdef LWC_SPLIT_LAYOUT
+	/* Strings point at their states, which are only where they should
+	 * be if the segment is mapped where its publisher had it */
+#ifdef MAP_FIXED_NOREPLACE
+	flags |= MAP_FIXED_NOREPLACE;
+#endif
+	base = mmap((void *)(uintptr_t)hdr.base, hdr.size, PROT_READ, flags,
+			fd, 0);
+	if (base != MAP_FAILED && (uintptr_t)base != hdr.base) {
+		munmap(base, hdr.size);
+		base = MAP_FAILED;
+	}
+
+	if (base == MAP_FAILED) {
+		/* Somewhere else, then; pointing the strings at their states
+		 * gives us private copies of every page holding them. */
+		uint64_t n;
+
+		base = mmap(NULL, hdr.size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE, fd, 0);
+		if (base == MAP_FAILED)
+			return lwc_error_oom;
+
+		if (lwc__shm_valid(base, &hdr) == false) {
+			munmap(base, hdr.size);
+			return lwc_error_invalid;
+		}
+
+		for (n = 0; n < hdr.bucketcount; n++) {
+			uint64_t offset = ((const uint64_t *)(const void *)
+					(base + hdr.buckets))[n];
+
+			while (offset != 0) {
+				lwc_shm_record *rec = (lwc_shm_record *)(void *)
+						(base + offset);
+
+				rec->str.state = &rec->state;
+				offset = rec->next;
+			}
+		}
+
+		result = lwc_error_unshared;
+	} else if (lwc__shm_valid(base, &hdr) == false) {
+		munmap(base, hdr.size);
+		return lwc_error_invalid;
+	}
+#else
+	/* Nothing in the segment depends on where it is mapped, and
+	 * nothing is written to it */
+	base = mmap(NULL, hdr.size, PROT_READ, flags, fd, 0);
+	if (base == MAP_FAILED)
+		return lwc_error_oom;
+
+	if (lwc__shm_valid(base, &hdr) == false) {
+		munmap(base, hdr.size);
+		return lwc_error_invalid;
+	}
+#endif
+
+	/* Only what was checked is used, whatever the segment says now */
+	lwc__shm_base = base;
+	lwc__shm_buckets = (const uint64_t *)(void *)(base + hdr.buckets);
+	lwc__shm_bucketcount = hdr.bucketcount;
+	lwc__shm_size = hdr.size;
+
+	/* Hash the way the publisher did, or we'll never find anything */
+	lwc__key[0] = hdr.key[0];
+	lwc__key[1] = hdr.key[1];
+	lwc__seed = (lwc_hash)hdr.seed;
+	lwc__seeded = true;
+
+	return result;
+}
+
+#else
+
+lwc_error
+lwc_shm_publish(int fd)
+{
+	UNUSED(fd);
+
+	return lwc_error_unsupported;
+}
+
+lwc_error
+lwc_shm_attach(int fd)
+{
+	UNUSED(fd);
+
+	return lwc_error_unsupported;
+}
+
+#endif
@@ -0,0 +1,175 @@
+/* shm.h
+ *
+ * Intern tables shared between processes.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_shm_h_
+#define libwapcaplet_shm_h_
+
+#include <stddef.h>
+
+#include "internal.h"
+
+#ifdef LWC_WITH_SHM
+
+/**
+ * A string in a shared segment.
+ *
+ * Chains and caseless forms link through offsets from the start of the
+ * segment, so that the table may be used wherever the segment is mapped
+ * without writing to it.  The string's own insensitive link is NULL.
+ */
+typedef struct lwc_shm_record_s {
+	uint64_t	next;	/**< Offset of next record in chain, or 0 */
+	uint64_t	insensitive; /**< Offset of caseless form's record */
+#ifdef LWC_SPLIT_LAYOUT
+	lwc_string_state state;	/**< State of str, which points here */
+#endif
+	lwc_string	str;
+	/* String data follows */
+} lwc_shm_record;
+
+extern const char *lwc__shm_base;
+extern const uint64_t *lwc__shm_buckets;
+extern uint64_t lwc__shm_bucketcount;
+extern uint64_t lwc__shm_size;
+
+static inline bool
+lwc__shm_attached(void)
+{
+	return lwc__shm_base != NULL;
+}
+
+/**
+ * Find out whether a string lives in the shared segment.
+ */
+static inline bool
+lwc__shm_contains(const lwc_string *str)
+{
+	return lwc__shm_base != NULL &&
+		(uintptr_t)str - (uintptr_t)lwc__shm_base < lwc__shm_size;
+}
+
+static inline lwc_string *
+lwc__shm_record_string(uint64_t offset)
+{
+	if (offset == 0)
+		return NULL;
+
+	return &((lwc_shm_record *)(uintptr_t)(lwc__shm_base + offset))->str;
+}
+
+/**
+ * Find the first string in the shared chain for a hash.
+ */
+static inline lwc_string *
+lwc__shm_chain(lwc_hash h)
+{
+	if (lwc__shm_base == NULL)
+		return NULL;
+
+	return lwc__shm_record_string(lwc__shm_buckets[h % lwc__shm_bucketcount]);
+}
+
+static inline const lwc_shm_record *
+lwc__shm_record_of(const lwc_string *str)
+{
+	return (const lwc_shm_record *)(const void *)
+			((const char *)str - offsetof(lwc_shm_record, str));
+}
+
+/**
+ * Find the next string in a shared chain.
+ */
+static inline lwc_string *
+lwc__shm_next(lwc_string *str)
+{
+	return lwc__shm_record_string(lwc__shm_record_of(str)->next);
+}
+
+/**
+ * Find the caseless form of a string in the shared segment.
+ */
+static inline lwc_string *
+lwc__shm_insensitive(const lwc_string *str)
+{
+	return lwc__shm_record_string(lwc__shm_record_of(str)->insensitive);
+}
+
+/**
+ * Call a callback for every string in the shared segment, if any.
+ *
+ * @param cb The callback to give each string to.
+ * @param pw The private word for the callback.
+ * @return true if there were any strings, false otherwise.
+ */
+bool lwc__shm_iterate(lwc_iteration_callback_fn cb, void *pw);
+
+#else
+
+static inline bool
+lwc__shm_attached(void)
+{
+	return false;
+}
+
+static inline bool
+lwc__shm_contains(const lwc_string *str)
+{
+	UNUSED(str);
+
+	return false;
+}
+
+static inline lwc_string *
+lwc__shm_chain(lwc_hash h)
+{
+	UNUSED(h);
+
+	return NULL;
+}
+
+static inline lwc_string *
+lwc__shm_next(lwc_string *str)
+{
+	UNUSED(str);
+
+	return NULL;
+}
+
+static inline lwc_string *
+lwc__shm_insensitive(const lwc_string *str)
+{
+	UNUSED(str);
+
+	return NULL;
+}
+
+static inline bool
+lwc__shm_iterate(lwc_iteration_callback_fn cb, void *pw)
+{
+	UNUSED(cb);
+	UNUSED(pw);
+
+	return false;
+}
+
+#endif
+
+/**
+ * Find the caseless form of a string, wherever it lives.
+ *
+ * @return The caseless form, or NULL if it hasn't been interned yet.
+ */
+static inline lwc_string *
+lwc__string_insensitive(const lwc_string *str)
+{
+	if (lwc__shm_contains(str))
+		return lwc__shm_insensitive(str);
+
+	return LWC_LOAD_ACQUIRE(&STATE_OF(str)->insensitive);
+}
+
+#endif /* libwapcaplet_shm_h_ */
@@ -0,0 +1,230 @@
+/* split.c
+ *
+ * Splitting delimited text into interned tokens.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "hash.h"
+#include "table.h"
+
+/* Up to this many delimiters are searched for a word at a time */
+#define SPLIT_WORD_DELIMS	(8)
+
+typedef struct lwc_split_s {
+	const char *	p;		/**< Where the next token is sought */
+	const char *	end;
+	uint8_t		set[32];	/**< Bitmap of delimiters */
+	uint64_t	words[SPLIT_WORD_DELIMS];	/**< Each repeated */
+	size_t		nwords;		/**< 0 if there are too many */
+} lwc_split;
+
+#define SPLIT_IS_DELIM(sp, c) \
+	(((sp)->set[(uint8_t)(c) >> 3] >> ((uint8_t)(c) & 7)) & 1)
+
+/* The hashes of a token, as far as it has been folded into them */
+typedef struct lwc_split_hash_s {
+	lwc_hash	z;
+	lwc_hash	c;		/**< Of the caseless form */
+	size_t		folded;		/**< Bytes folded in so far */
+#ifdef LWC_UNICODE_FOLD
+	char		high;		/**< Every byte folded in, or'd */
+#endif
+} lwc_split_hash;
+
+/**
+ * Fold the bytes of a token up to a point into its hashes.
+ */
+static inline void
+lwc__split_fold(lwc_split_hash *h, const char *s, size_t upto)
+{
+	for (; h->folded < upto; h->folded++) {
+		h->z *= FNV_PRIME;
+		h->c *= FNV_PRIME;
+		h->z ^= s[h->folded];
+		h->c ^= lwc__dolower(s[h->folded]);
+#ifdef LWC_UNICODE_FOLD
+		h->high |= s[h->folded];
+#endif
+	}
+}
+
+/**
+ * Find out whether a word of text holds any of the delimiters.
+ */
+static inline bool
+lwc__split_word_has_delim(const lwc_split *sp, const char *p)
+{
+	uint64_t w, found = 0;
+	size_t i;
+
+	memcpy(&w, p, sizeof(w));
+	for (i = 0; i < sp->nwords; i++)
+		found |= lwc__word_zeros(w ^ sp->words[i]);
+
+	return found != 0;
+}
+
+/**
+ * Find the end of a token and hash it on the way.
+ *
+ * Tokens are scanned eight bytes at a time until a word holds a
+ * delimiter, and then a byte at a time to find which.  Once a token is
+ * too long to be hashed by its words, each byte is folded into its
+ * hashes as the scan passes it, starting with those already passed.
+ */
+static void
+lwc__split_token(const lwc_split *sp, const char *s, lwc_bulk_entry *entry)
+{
+	const char *p = s, *end = sp->end;
+	lwc_split_hash h;
+	uint64_t lower[2];
+
+	h.z = h.c = FNV_OFFSET_BASIS ^ lwc__seed;
+	h.folded = 0;
+#ifdef LWC_UNICODE_FOLD
+	h.high = 0;
+#endif
+
+	if (sp->nwords > 0) {
+		while (end - p >= 8 && !lwc__split_word_has_delim(sp, p)) {
+			p += 8;
+			if (p - s > LWC_SHORT_MAX)
+				lwc__split_fold(&h, s, p - s);
+		}
+	}
+
+	while (p < end && SPLIT_IS_DELIM(sp, *p) == 0) {
+		p++;
+		if (p - s > LWC_SHORT_MAX)
+			lwc__split_fold(&h, s, p - s);
+	}
+
+	entry->s = s;
+	entry->len = p - s;
+	entry->hashed = true;
+
+	if (entry->len > LWC_SHORT_MAX) {
+		entry->hash = h.z;
+		entry->chash = h.c;
+#ifdef LWC_UNICODE_FOLD
+		/* Caseless forms of UTF-8 are left to be hashed by folding */
+		if (h.high & 0x80)
+			entry->hashed = false;
+#endif
+		return;
+	}
+
+	lwc__short_words(s, entry->len, entry->word);
+	entry->hash = lwc__short_hash(entry->word, entry->len);
+
+#ifdef LWC_UNICODE_FOLD
+	if (((entry->word[0] | entry->word[1]) & LWC_BYTES(0x80)) != 0) {
+		entry->hashed = false;
+		return;
+	}
+#endif
+
+	lower[0] = lwc__word_lower(entry->word[0]);
+	lower[1] = lwc__word_lower(entry->word[1]);
+	entry->chash = lwc__short_hash(lower, entry->len);
+}
+
+static lwc_error
+lwc__split_next(void *pw, lwc_bulk_entry *entry)
+{
+	lwc_split *sp = pw;
+	const char *p = sp->p;
+
+	while (p < sp->end && SPLIT_IS_DELIM(sp, *p))
+		p++;
+
+	if (p == sp->end) {
+		sp->p = p;
+		return lwc_error_range;
+	}
+
+	lwc__split_token(sp, p, entry);
+	sp->p = p + entry->len;
+
+	return lwc_error_ok;
+}
+
+/**
+ * Count the tokens left, finding only where each ends.
+ */
+static size_t
+lwc__split_count(const lwc_split *sp)
+{
+	const char *p = sp->p, *end = sp->end;
+	size_t n = 0;
+
+	for (;;) {
+		while (p < end && SPLIT_IS_DELIM(sp, *p))
+			p++;
+		if (p == end)
+			return n;
+
+		n++;
+		if (sp->nwords > 0) {
+			while (end - p >= 8 &&
+					!lwc__split_word_has_delim(sp, p))
+				p += 8;
+		}
+		while (p < end && SPLIT_IS_DELIM(sp, *p) == 0)
+			p++;
+	}
+}
+
+lwc_error
+lwc_intern_split(const char *s, size_t slen, const char *delims,
+		 lwc_string **strs, size_t *count)
+{
+	lwc_split sp;
+	lwc_error err;
+	size_t n;
+
+	assert((s != NULL) || (slen == 0));
+	assert(delims != NULL);
+	assert(count != NULL);
+	assert((strs != NULL) || (*count == 0));
+
+	sp.p = s;
+	sp.end = s + slen;
+	sp.nwords = 0;
+	memset(sp.set, 0, sizeof(sp.set));
+
+	for (n = 0; delims[n] != '\0'; n++) {
+		uint8_t c = (uint8_t)delims[n];
+
+		sp.set[c >> 3] |= 1 << (c & 7);
+		if (n < SPLIT_WORD_DELIMS)
+			sp.words[n] = LWC_BYTES(c);
+	}
+
+	if (n <= SPLIT_WORD_DELIMS)
+		sp.nwords = n;
+
+	/* Every token but the last is followed by a delimiter, so unless
+	 * there is room for a token in every other byte, count them first
+	 * and say how much is needed without interning any */
+	if (*count < slen / 2 + slen % 2) {
+		n = lwc__split_count(&sp);
+		if (n > *count) {
+			*count = n;
+			return lwc_error_range;
+		}
+	}
+
+	n = *count;
+	err = lwc__intern_bulk(lwc__split_next, &sp, strs, &n);
+	if (err != lwc_error_ok)
+		return err;
+
+	*count = n;
+
+	return lwc_error_ok;
+}
@@ -0,0 +1,300 @@
+/* table.c
+ *
+ * Encoding sets of strings as string tables, and interning them again.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "hash.h"
+#include "table.h"
+
+#define TABLE_VERSION	(1)
+
+/*
+ * A table starts with "LWCT", a version byte, the width of a hash in
+ * bytes and the hash fingerprint of the encoding process.  Then comes
+ * the number of strings, and for each string its length, its hash and
+ * the hash of its caseless form, and its bytes.  Counts and lengths are
+ * unsigned LEB128 and hashes are little endian.
+ *
+ * Hashes are seeded per process, so they only match those of the
+ * decoding process if it has the same fingerprint: the process that
+ * encoded the table, or one forked from it after hashing started.
+ * They are not used when decoding, as nothing vouches for them.
+ */
+static const uint8_t lwc__table_magic[4] = { 'L', 'W', 'C', 'T' };
+
+/* Bytes in a table before its fingerprint */
+#define TABLE_PREAMBLE	(sizeof(lwc__table_magic) + 2)
+
+/* Long enough to be hashed as a long string */
+static const char lwc__table_probe[] = "libwapcaplet string table";
+
+/**
+ * The hash of a fixed string, which differs between processes unless
+ * they hash every string the same way.
+ */
+static lwc_hash
+lwc__table_fingerprint(void)
+{
+	return lwc_calculate_hash(lwc__table_probe,
+			sizeof(lwc__table_probe) - 1);
+}
+
+static size_t
+lwc__table_uint_size(uint64_t v)
+{
+	size_t size = 1;
+
+	while (v >= 0x80) {
+		v >>= 7;
+		size++;
+	}
+
+	return size;
+}
+
+static uint8_t *
+lwc__table_put_uint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+
+	return p;
+}
+
+static uint8_t *
+lwc__table_put_hash(uint8_t *p, lwc_hash h)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(lwc_hash); i++) {
+		*p++ = (uint8_t)h;
+		h >>= 8;
+	}
+
+	return p;
+}
+
+/**** Encoding ****/
+
+/* A distinct string found by the encoder */
+typedef struct lwc_table_slot_s {
+	lwc_string *	str;
+	uint32_t	index;		/**< Its position in the table */
+} lwc_table_slot;
+
+lwc_error
+lwc_table_encode(lwc_string *const *strs, size_t n, uint32_t *indices,
+		 void *buf, size_t *size)
+{
+	lwc_table_slot *slots;
+	lwc_string **distinct;
+	size_t mask, i, count = 0, needed;
+	uint8_t *p;
+
+	assert((strs != NULL) || (n == 0));
+	assert(size != NULL);
+
+	if (n > UINT32_MAX)
+		return lwc_error_range;
+
+	/* Interned strings are equal only if they are the same string, so
+	 * a set of pointers finds the distinct ones.  Keep it at most half
+	 * full, and let the string's own hash place it. */
+	for (mask = 15; mask < n * 2; mask = mask * 2 + 1)
+		;
+
+	slots = LWC_ALLOC(sizeof(lwc_table_slot) * (mask + 1));
+	if (slots == NULL)
+		return lwc_error_oom;
+
+	distinct = LWC_ALLOC(sizeof(lwc_string *) * (n > 0 ? n : 1));
+	if (distinct == NULL) {
+		LWC_FREE(slots, sizeof(lwc_table_slot) * (mask + 1));
+		return lwc_error_oom;
+	}
+
+	memset(slots, 0, sizeof(lwc_table_slot) * (mask + 1));
+
+	needed = TABLE_PREAMBLE + sizeof(lwc_hash);
+
+	for (i = 0; i < n; i++) {
+		lwc_string *str = strs[i];
+		size_t slot = str->hash & mask;
+
+		assert(str != NULL);
+
+		while (slots[slot].str != NULL && slots[slot].str != str)
+			slot = (slot + 1) & mask;
+
+		if (slots[slot].str == NULL) {
+			slots[slot].str = str;
+			slots[slot].index = (uint32_t)count;
+			distinct[count++] = str;
+
+			needed += lwc__table_uint_size(str->len) +
+					2 * sizeof(lwc_hash) + str->len;
+		}
+
+		if (indices != NULL)
+			indices[i] = slots[slot].index;
+	}
+
+	needed += lwc__table_uint_size(count);
+
+	LWC_FREE(slots, sizeof(lwc_table_slot) * (mask + 1));
+
+	if (buf == NULL || *size < needed) {
+		LWC_FREE(distinct, sizeof(lwc_string *) * (n > 0 ? n : 1));
+		*size = needed;
+		return lwc_error_range;
+	}
+
+	p = buf;
+	memcpy(p, lwc__table_magic, sizeof(lwc__table_magic));
+	p += sizeof(lwc__table_magic);
+	*p++ = TABLE_VERSION;
+	*p++ = sizeof(lwc_hash);
+	p = lwc__table_put_hash(p, lwc__table_fingerprint());
+	p = lwc__table_put_uint(p, count);
+
+	for (i = 0; i < count; i++) {
+		lwc_string *str = distinct[i];
+
+		p = lwc__table_put_uint(p, str->len);
+		p = lwc__table_put_hash(p, str->hash);
+		p = lwc__table_put_hash(p, str->chash);
+		memcpy(p, CSTR_OF(str), str->len);
+		p += str->len;
+	}
+
+	assert(p == (uint8_t *)buf + needed);
+
+	LWC_FREE(distinct, sizeof(lwc_string *) * (n > 0 ? n : 1));
+	*size = needed;
+
+	return lwc_error_ok;
+}
+
+/**** Decoding ****/
+
+typedef struct lwc_table_reader_s {
+	const uint8_t *	p;
+	const uint8_t *	end;
+	size_t		width;		/**< Bytes in each stored hash */
+} lwc_table_reader;
+
+static bool
+lwc__table_get_uint(lwc_table_reader *r, uint64_t *v)
+{
+	unsigned int shift = 0;
+	uint8_t b;
+
+	*v = 0;
+	do {
+		if (shift > 63 || r->p == r->end)
+			return false;
+		b = *r->p++;
+		*v |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+
+	return true;
+}
+
+static bool
+lwc__table_get_hash(lwc_table_reader *r, lwc_hash *h)
+{
+	size_t i;
+
+	if ((size_t)(r->end - r->p) < r->width)
+		return false;
+
+	/* Wider hashes than ours are read short */
+	*h = 0;
+	for (i = r->width; i > 0; i--)
+		*h = (*h << 8) | r->p[i - 1];
+	r->p += r->width;
+
+	return true;
+}
+
+static lwc_error
+lwc__table_next(void *pw, lwc_bulk_entry *entry)
+{
+	lwc_table_reader *r = pw;
+	uint64_t len;
+
+	if (lwc__table_get_uint(r, &len) == false ||
+			lwc__table_get_hash(r, &entry->hash) == false ||
+			lwc__table_get_hash(r, &entry->chash) == false ||
+			len > (uint64_t)(r->end - r->p))
+		return lwc_error_invalid;
+
+	entry->s = (const char *)r->p;
+	entry->len = (size_t)len;
+	/* A table with a matching fingerprint may still have been changed
+	 * since, and a wrong hash would intern a second copy of a string,
+	 * so always hash again: the strings are in cache now anyway */
+	entry->hashed = false;
+	r->p += len;
+
+	return lwc_error_ok;
+}
+
+lwc_error
+lwc_table_decode(const void *buf, size_t size, lwc_string **strs,
+		 size_t *count)
+{
+	lwc_table_reader r;
+	lwc_hash fingerprint;
+	uint64_t n;
+	lwc_error err;
+
+	assert((buf != NULL) || (size == 0));
+	assert(count != NULL);
+
+	r.p = buf;
+	r.end = r.p + size;
+
+	if (size < TABLE_PREAMBLE || memcmp(r.p, lwc__table_magic,
+			sizeof(lwc__table_magic)) != 0 ||
+			r.p[4] != TABLE_VERSION ||
+			r.p[5] == 0 || r.p[5] > sizeof(uint64_t))
+		return lwc_error_invalid;
+
+	r.width = r.p[5];
+	r.p += TABLE_PREAMBLE;
+
+	if (lwc__table_get_hash(&r, &fingerprint) == false)
+		return lwc_error_invalid;
+
+	/* Every string takes a length byte and two hashes at least */
+	if (lwc__table_get_uint(&r, &n) == false || n > UINT32_MAX ||
+			n > (uint64_t)(r.end - r.p) / (1 + 2 * r.width))
+		return lwc_error_invalid;
+
+	if (strs == NULL || *count < n) {
+		*count = (size_t)n;
+		return lwc_error_range;
+	}
+
+	*count = (size_t)n;
+	err = lwc__intern_bulk(lwc__table_next, &r, strs, count);
+	if (err != lwc_error_ok)
+		return err;
+
+	if (r.p != r.end) {
+		lwc_string_unref_many(strs, *count);
+		return lwc_error_invalid;
+	}
+
+	return lwc_error_ok;
+}
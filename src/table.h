@@ -0,0 +1,53 @@
+/* table.h
+ *
+ * Interning strings in bulk.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_table_h_
+#define libwapcaplet_table_h_
+
+#include "internal.h"
+
+/**
+ * A string to intern in bulk.
+ */
+typedef struct lwc_bulk_entry_s {
+	const char *	s;
+	size_t		len;
+	lwc_hash	hash;		/**< Hash of the string, if hashed */
+	lwc_hash	chash;		/**< Hash of its caseless form, if hashed */
+	uint64_t	word[2];	/**< Its words, if hashed and short */
+	bool		hashed;		/**< Whether the above may be used */
+} lwc_bulk_entry;
+
+/**
+ * Produce the next string to intern in bulk.
+ *
+ * @param pw    The private word given to ::lwc__intern_bulk.
+ * @param entry Filled out with the string.
+ * @return lwc_error_ok, lwc_error_range if there are no more strings,
+ *	   or another error to abandon interning with.
+ */
+typedef lwc_error (*lwc_bulk_next_fn)(void *pw, lwc_bulk_entry *entry);
+
+/**
+ * Intern a number of strings with the table locked once.
+ *
+ * Entries which come hashed are used as they are, so producers which
+ * read every byte anyway can hash as they go.  Short strings must then
+ * come with their words, as lwc__short_words() loads them.
+ *
+ * @param next Called for each string in turn, with the table locked.
+ * @param pw   The private word for \a next.
+ * @param strs Filled out with a reference to each string.
+ * @param n    On entry, the most strings to intern.  On exit, the
+ *	       number interned.
+ * @return lwc_error_ok on success, or the first error met, in which
+ *	   case no references are held.
+ */
+lwc_error lwc__intern_bulk(lwc_bulk_next_fn next, void *pw,
+		lwc_string **strs, size_t *n);
+
+#endif /* libwapcaplet_table_h_ */
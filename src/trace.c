@@ -0,0 +1,108 @@
+/* trace.c
+ *
+ * Tracing callbacks and latency histograms.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <string.h>
+
+#include "trace.h"
+
+#ifdef LWC_WITH_TRACE
+
+bool lwc__tracing = false;
+
+static lwc_trace_callback_fn lwc__trace_cb = NULL;
+static void *lwc__trace_pw = NULL;
+static unsigned int lwc__trace_sample = 0;
+static unsigned int lwc__trace_tick = 0;
+static uint64_t lwc__trace_hist[lwc_trace_op_count][LWC_TRACE_HISTOGRAM_SIZE];
+
+/* The tick and histograms are updated by interning frozen strings too,
+ * which takes no lock, so they are only ever added to. */
+
+uint64_t
+lwc__trace_start(void)
+{
+	unsigned int sample = lwc__trace_sample;
+
+	if (sample == 0 || LWC_ADD_RELAXED(&lwc__trace_tick, 1) % sample != 0)
+		return 0;
+
+	return lwc__now();
+}
+
+void
+lwc__trace_time(lwc_trace_op op, uint64_t start)
+{
+	uint64_t elapsed = lwc__now() - start;
+	unsigned int bucket = 0;
+
+	while (elapsed > 1 && bucket < LWC_TRACE_HISTOGRAM_SIZE - 1) {
+		elapsed >>= 1;
+		bucket++;
+	}
+
+	(void) LWC_ADD_RELAXED(&lwc__trace_hist[op][bucket], 1);
+}
+
+void
+lwc__trace_event(lwc_trace_op op, lwc_string *str, uint64_t start)
+{
+	if (start != 0)
+		lwc__trace_time(op, start);
+
+	if (lwc__trace_cb != NULL)
+		lwc__trace_cb(op, str, lwc__trace_pw);
+}
+
+lwc_error
+lwc_set_trace_callback(lwc_trace_callback_fn cb, void *pw,
+		       unsigned int sample)
+{
+	lwc__trace_cb = cb;
+	lwc__trace_pw = pw;
+	lwc__trace_sample = sample;
+	lwc__trace_tick = 0;
+	lwc__tracing = (cb != NULL) || (sample != 0);
+
+	return lwc_error_ok;
+}
+
+lwc_error
+lwc_trace_histogram(lwc_trace_op op,
+		    uint64_t hist[LWC_TRACE_HISTOGRAM_SIZE])
+{
+	assert(op < lwc_trace_op_count);
+	assert(hist);
+
+	memcpy(hist, lwc__trace_hist[op], sizeof(lwc__trace_hist[op]));
+
+	return lwc_error_ok;
+}
+
+#else
+
+lwc_error
+lwc_set_trace_callback(lwc_trace_callback_fn cb, void *pw,
+		       unsigned int sample)
+{
+	UNUSED(cb);
+	UNUSED(pw);
+	UNUSED(sample);
+
+	return lwc_error_unsupported;
+}
+
+lwc_error
+lwc_trace_histogram(lwc_trace_op op,
+		    uint64_t hist[LWC_TRACE_HISTOGRAM_SIZE])
+{
+	UNUSED(op);
+	UNUSED(hist);
+
+	return lwc_error_unsupported;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/* trace.h
+ *
+ * Tracing points for libwapcaplet.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#ifndef libwapcaplet_trace_h_
+#define libwapcaplet_trace_h_
+
+#include "internal.h"
+
+#ifdef LWC_WITH_SDT
+#include <sys/sdt.h>
+#define LWC__PROBE(op, str)						\
+	DTRACE_PROBE3(libwapcaplet, op, CSTR_OF(str), (str)->len, (str))
+#else
+#define LWC__PROBE(op, str) ((void)0)
+#endif
+
+#ifdef LWC_WITH_TRACE
+
+extern bool lwc__tracing;
+
+uint64_t lwc__trace_start(void);
+void lwc__trace_time(lwc_trace_op op, uint64_t start);
+void lwc__trace_event(lwc_trace_op op, lwc_string *str, uint64_t start);
+
+/**
+ * Note the start of a traced operation.
+ *
+ * This must be used where a declaration may appear, once per operation,
+ * as it counts towards the sampling interval.  Operations made of others
+ * pass the value on, or zero so that the parts aren't timed.
+ */
+#define LWC_TRACE_START(t)						\
+	uint64_t t = lwc__tracing ? lwc__trace_start() : 0
+
+/**
+ * Report a traced operation.
+ *
+ * @param op  The operation, without its lwc_trace_ prefix.
+ * @param str The string operated upon.
+ * @param t   The value declared by LWC_TRACE_START.
+ */
+#define LWC_TRACE(op, str, t) do {					\
+		LWC__PROBE(op, str);					\
+		if (lwc__tracing)					\
+			lwc__trace_event(lwc_trace_##op, (str), (t));	\
+	} while (0)
+
+/**
+ * Time a traced operation without reporting it.
+ *
+ * For operations which must be reported before they finish, as
+ * destruction is.
+ */
+#define LWC_TRACE_TIME(op, t) do {					\
+		if ((t) != 0)						\
+			lwc__trace_time(lwc_trace_##op, (t));		\
+	} while (0)
+
+#else
+
+#define LWC_TRACE_START(t) const uint64_t t = 0
+#define LWC_TRACE(op, str, t) do {					\
+		LWC__PROBE(op, str);					\
+		(void) (t);						\
+	} while (0)
+#define LWC_TRACE_TIME(op, t) ((void) (t))
+
+#endif
+
+#endif /* libwapcaplet_trace_h_ */
@@ -8,7 +8,15 @@
 
 #include <check.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#ifdef LWC_WITH_THREADS
+#include <pthread.h>
+#endif
+#ifdef LWC_WITH_SHM
+#include <sys/mman.h>
+#endif
 
 #include "tests.h"
 
@@ -100,6 +108,14 @@ END_TEST
 
 /**** The next set of tests need a fixture set ****/
 
+static void
+counting_cb(lwc_string *str, void *pw)
+{
+        UNUSED(str);
+        
+        *((int *)pw) += 1;
+}
+
 static void
 with_simple_context_setup(void)
 {
@@ -150,6 +166,373 @@ START_TEST (test_lwc_intern_string_twice_same_ok)
 }
 END_TEST
 
+START_TEST (test_lwc_intern_many_ok)
+{
+        char buf[16];
+        lwc_string *strs[20000], *again;
+        int i, counter = 0;
+
+        for (i = 0; i < 20000; i++) {
+                int len = snprintf(buf, sizeof(buf), "s%d", i);
+                fail_unless(lwc_intern_string(buf, len, &strs[i]) == lwc_error_ok,
+                            "Unable to intern a generated string");
+        }
+
+        for (i = 0; i < 20000; i++) {
+                int len = snprintf(buf, sizeof(buf), "s%d", i);
+                fail_unless(lwc_intern_string(buf, len, &again) == lwc_error_ok,
+                            "Unable to re-intern a generated string");
+                fail_unless(again == strs[i],
+                            "Re-interning a generated string gave a new one");
+                lwc_string_unref(again);
+                lwc_string_unref(strs[i]);
+        }
+
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Generated strings survived unref");
+}
+END_TEST
+
+/* As many buckets as a table has, and more strings in one bucket than a
+ * table puts up with before switching to keyed buckets */
+#define REKEY_BUCKETS   4091
+#define REKEY_CHAIN     100
+#define REKEY_OTHERS    1000
+
+START_TEST (test_lwc_rekey)
+{
+        char buf[16];
+        lwc_string *strs[REKEY_OTHERS + REKEY_CHAIN], *again;
+        lwc_hash bucket = 0;
+        int i, n = 0, counter = 0;
+
+        for (i = 0; i < REKEY_OTHERS; i++) {
+                int len = snprintf(buf, sizeof(buf), "s%d", i);
+                fail_unless(lwc_intern_string(buf, len, &strs[n++]) == lwc_error_ok);
+        }
+
+        /* Strings whose hashes all pick the same unkeyed bucket */
+        for (i = 0; n < REKEY_OTHERS + REKEY_CHAIN; i++) {
+                int len = snprintf(buf, sizeof(buf), "k%d", i);
+                lwc_hash h = lwc_calculate_hash(buf, len) % REKEY_BUCKETS;
+
+                if (n == REKEY_OTHERS)
+                        bucket = h;
+                else if (h != bucket)
+                        continue;
+                fail_unless(lwc_intern_string(buf, len, &strs[n++]) == lwc_error_ok);
+        }
+
+        for (i = 0; i < n; i++) {
+                fail_unless(lwc_intern_string(lwc_string_data(strs[i]),
+                                              lwc_string_length(strs[i]),
+                                              &again) == lwc_error_ok);
+                fail_unless(again == strs[i],
+                            "Re-interning after rekeying gave a new string");
+                lwc_string_unref(again);
+        }
+
+        lwc_string_unref_many(strs, n);
+
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Rekeyed strings survived unref");
+}
+END_TEST
+
+START_TEST (test_lwc_string_unref_many_ok)
+{
+        char buf[16];
+        lwc_string *strs[1002], *upper, *lower;
+        int i, counter = 0;
+        bool result;
+
+        for (i = 0; i < 1000; i++) {
+                int len = snprintf(buf, sizeof(buf), "s%d", i % 500);
+                fail_unless(lwc_intern_string(buf, len, &strs[i]) == lwc_error_ok,
+                            "Unable to intern a generated string");
+        }
+
+        fail_unless(lwc_intern_string("UPPER", 5, &upper) == lwc_error_ok);
+        fail_unless(lwc_intern_string("upper", 5, &lower) == lwc_error_ok);
+        fail_unless(lwc_string_caseless_isequal(upper, lower, &result) == lwc_error_ok);
+        fail_unless(result == true, "'UPPER' !~= 'upper' ?!");
+        strs[1000] = lower;
+        strs[1001] = upper;
+
+        lwc_string_unref_many(strs, 1002);
+
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Strings survived lwc_string_unref_many");
+}
+END_TEST
+
+START_TEST (test_lwc_short_strings)
+{
+        static const char upper_data[] = "ABCDEFGHIJKLMNOPQRST";
+        static const char lower_data[] = "abcdefghijklmnopqrst";
+        lwc_string *upper, *lower, *other, *again;
+        char buf[24];
+        lwc_hash hash;
+        bool result;
+        size_t len;
+
+        /* Either side of every word boundary the short path has */
+        for (len = 1; len < sizeof(upper_data); len++) {
+                fail_unless(lwc_intern_string(upper_data, len, &upper) == lwc_error_ok);
+                fail_unless(lwc_intern_string(lower_data, len, &lower) == lwc_error_ok);
+                fail_unless(upper != lower, "Case was ignored when interning");
+                fail_unless(lwc_string_full_hash_value(upper) ==
+                            lwc_calculate_hash(upper_data, len),
+                            "Hash differs from lwc_calculate_hash");
+
+                fail_unless(lwc_string_caseless_isequal(upper, lower, &result) == lwc_error_ok);
+                fail_unless(result == true, "Caseless comparison failed");
+                fail_unless(lwc_string_caseless_hash_value(upper, &hash) == lwc_error_ok);
+                fail_unless(hash == lwc_string_full_hash_value(lower),
+                            "Caseless hash isn't the hash of the lower case string");
+
+                /* A change to any one byte is a different string */
+                memcpy(buf, lower_data, len);
+                buf[len / 2] = '_';
+                fail_unless(lwc_intern_string(buf, len, &other) == lwc_error_ok);
+                fail_unless(other != lower, "Different strings interned as one");
+
+                fail_unless(lwc_intern_string(lower_data, len, &again) == lwc_error_ok);
+                fail_unless(again == lower, "Short string not found again");
+
+                lwc_string_unref(again);
+                lwc_string_unref(other);
+                lwc_string_unref(lower);
+                lwc_string_unref(upper);
+        }
+}
+END_TEST
+
+START_TEST (test_lwc_deferred_reclaim)
+{
+        lwc_string *hello, *HELLO, *again, *lower;
+        int counter = 0;
+
+        fail_unless(lwc_set_reclaim_mode(lwc_reclaim_deferred) == lwc_error_ok);
+
+        fail_unless(lwc_intern_string("Hello", 5, &hello) == lwc_error_ok);
+        fail_unless(lwc_intern_string("HELLO", 5, &HELLO) == lwc_error_ok);
+        fail_unless(lwc_string_tolower(HELLO, &lower) == lwc_error_ok);
+        lwc_string_unref(lower);
+        lwc_string_unref(hello);
+        lwc_string_unref(HELLO);
+
+        lwc_iterate_prefix("H", 1, counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Dead strings were iterated");
+
+        fail_unless(lwc_intern_string("Hello", 5, &again) == lwc_error_ok);
+        fail_unless(again == hello, "Dead string was not brought back");
+        lwc_string_unref(again);
+
+        fail_unless(lwc_collect() == 3, "Incorrect number of strings collected");
+        fail_unless(lwc_collect() == 0, "Strings collected twice");
+
+        counter = 0;
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Strings survived collection");
+
+#ifdef LWC_DEFERRED_RECLAIM
+        fail_unless(lwc_set_reclaim_mode(lwc_reclaim_immediate) == lwc_error_unsupported);
+#else
+        fail_unless(lwc_set_reclaim_mode(lwc_reclaim_immediate) == lwc_error_ok);
+#endif
+}
+END_TEST
+
+#ifdef LWC_DEFERRED_RECLAIM
+START_TEST (test_lwc_background_reclaim)
+{
+        fail_unless(lwc_set_reclaim_mode(lwc_reclaim_background) == lwc_error_unsupported);
+}
+END_TEST
+#else
+START_TEST (test_lwc_background_reclaim)
+{
+        lwc_string *hello, *HELLO, *again, *lower, *world;
+        int counter = 0;
+
+        fail_unless(lwc_set_reclaim_mode(lwc_reclaim_background) == lwc_error_ok);
+
+        fail_unless(lwc_intern_string("Hello", 5, &hello) == lwc_error_ok);
+        fail_unless(lwc_intern_string("HELLO", 5, &HELLO) == lwc_error_ok);
+        fail_unless(lwc_intern_string("world", 5, &world) == lwc_error_ok);
+        fail_unless(lwc_string_tolower(HELLO, &lower) == lwc_error_ok);
+        lwc_string_unref(lower);
+        lwc_string_unref(hello);
+        lwc_string_unref(HELLO);
+
+        /* Gone from the table at once */
+        lwc_iterate_prefix("H", 1, counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Dying strings were iterated");
+        fail_unless(lwc_collect() == 0, "Dying strings were collected");
+
+        fail_unless(lwc_intern_string("Hello", 5, &again) == lwc_error_ok);
+        lwc_string_unref(again);
+
+        fail_unless(lwc_reclaim(0) == 0, "Budget was exceeded");
+        fail_unless(lwc_reclaim(1) == 1, "Incorrect number of strings reclaimed");
+        fail_unless(lwc_reclaim(SIZE_MAX) == 3, "Incorrect number of strings reclaimed");
+        fail_unless(lwc_reclaim(SIZE_MAX) == 0, "Strings reclaimed twice");
+
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 1, "Live string was reclaimed");
+
+        /* Leaving the mode frees whatever is still queued */
+        fail_unless(lwc_intern_string("Hello", 5, &hello) == lwc_error_ok);
+        lwc_string_unref(hello);
+        lwc_string_unref(world);
+        fail_unless(lwc_set_reclaim_mode(lwc_reclaim_immediate) == lwc_error_ok);
+        fail_unless(lwc_reclaim(SIZE_MAX) == 0, "Queued strings were leaked");
+}
+END_TEST
+#endif
+
+#ifdef LWC_WITH_THREADS
+#define THREAD_COUNT 4
+
+static lwc_string *thread_strs[16];
+
+static void *
+threaded_worker(void *pw)
+{
+        lwc_string *mine[64];
+        char buf[16];
+        int i, round;
+
+        UNUSED(pw);
+
+        for (round = 0; round < 200; round++) {
+                for (i = 0; i < 64; i++) {
+                        int len = snprintf(buf, sizeof(buf), "t%d", i);
+                        if (lwc_intern_string(buf, len, &mine[i]) != lwc_error_ok)
+                                return (void *) 1;
+                }
+                for (i = 0; i < 16; i++)
+                        (void) lwc_string_ref(thread_strs[i]);
+                for (i = 0; i < 64; i++)
+                        lwc_string_unref(mine[i]);
+                for (i = 0; i < 16; i++)
+                        lwc_string_unref(thread_strs[i]);
+        }
+
+        return NULL;
+}
+
+static void *
+threaded_releaser(void *pw)
+{
+        lwc_string_unref((lwc_string *) pw);
+
+        return NULL;
+}
+
+START_TEST (test_lwc_threaded_refcounting)
+{
+        pthread_t threads[THREAD_COUNT];
+        lwc_string *handed;
+        char buf[16];
+        void *result;
+        int i, counter = 0;
+
+        for (i = 0; i < 16; i++) {
+                int len = snprintf(buf, sizeof(buf), "t%d", i * 4);
+                fail_unless(lwc_intern_string(buf, len, &thread_strs[i]) == lwc_error_ok);
+        }
+
+        for (i = 0; i < THREAD_COUNT; i++)
+                fail_unless(pthread_create(&threads[i], NULL,
+                                           threaded_worker, NULL) == 0);
+        for (i = 0; i < THREAD_COUNT; i++) {
+                fail_unless(pthread_join(threads[i], &result) == 0);
+                fail_unless(result == NULL, "Interning failed in a thread");
+        }
+
+        for (i = 0; i < 16; i++)
+                lwc_string_unref(thread_strs[i]);
+
+        /* Released by a thread other than the one which interned it */
+        fail_unless(lwc_intern_string("handed", 6, &handed) == lwc_error_ok);
+        fail_unless(pthread_create(&threads[0], NULL,
+                                   threaded_releaser, handed) == 0);
+        fail_unless(pthread_join(threads[0], NULL) == 0);
+
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Strings survived their threads");
+}
+END_TEST
+#endif
+
+static size_t counted_bytes, counted_allocs;
+
+static void *
+counting_alloc(size_t size, void *pw)
+{
+        *((size_t *)pw) += 1;
+        counted_bytes += size;
+        counted_allocs++;
+        return malloc(size);
+}
+
+static void
+counting_sized_free(void *ptr, size_t size, void *pw)
+{
+        UNUSED(pw);
+        counted_bytes -= size;
+        counted_allocs--;
+        free(ptr);
+}
+
+START_TEST (test_lwc_set_allocator_ok)
+{
+        lwc_replay_stats stats[LWC_REPLAY_STATS_SIZE];
+        size_t calls = 0;
+        lwc_string *str1, *str2;
+        FILE *trace;
+        bool result;
+        int counter = 0;
+
+        fail_unless(lwc_set_allocator(counting_alloc, NULL,
+                                      counting_sized_free, &calls) == lwc_error_ok,
+                    "Unable to set allocator");
+
+        fail_unless(lwc_intern_string("Badger", 6, &str1) == lwc_error_ok);
+        fail_unless(lwc_intern_string("badger", 6, &str2) == lwc_error_ok);
+        fail_unless(lwc_string_caseless_isequal(str1, str2, &result) == lwc_error_ok);
+        lwc_iterate_prefix("b", 1, counting_cb, (void*)&counter);
+        fail_unless(counter == 1, "Incorrect count for 'b'");
+        fail_unless(calls > 2, "Allocator wasn't used");
+        fail_unless(counted_bytes > 12, "Allocations were too small");
+
+        fail_unless(lwc_set_allocator(NULL, NULL, NULL, NULL) == lwc_error_busy,
+                    "Able to change allocator with strings interned");
+
+        lwc_string_unref(str1);
+        lwc_string_unref(str2);
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+
+        fail_unless(counted_allocs == 0, "Allocations were leaked");
+        fail_unless(counted_bytes == 0, "Frees were given the wrong size");
+
+        /* The replay's own state isn't libwapcaplet's memory */
+        trace = tmpfile();
+        fail_unless(trace != NULL, "Unable to create trace file");
+        fputs("LWCR\x01", trace);
+        fflush(trace);
+        fail_unless(lseek(fileno(trace), 0, SEEK_SET) == 0);
+        calls = 0;
+        fail_unless(lwc_replay(fileno(trace), stats) == lwc_error_ok);
+        fail_unless(calls == 0, "Replay state was counted");
+        fclose(trace);
+
+        fail_unless(lwc_set_allocator(NULL, NULL, NULL, NULL) == lwc_error_ok);
+}
+END_TEST
+
 /**** The next set of tests need a fixture set with some strings ****/
 
 static lwc_string *intern_one = NULL, *intern_two = NULL, *intern_three = NULL, *intern_YAY = NULL;
@@ -294,6 +677,34 @@ START_TEST (test_lwc_string_caseless_isequal_ok2)
 }
 END_TEST
 
+START_TEST (test_lwc_string_caseless_no_intern)
+{
+        bool result = false;
+        lwc_string *new_ONE;
+        lwc_hash hash1, hash2;
+        int counter = 0;
+
+        fail_unless(lwc_intern_string("ONE", 3, &new_ONE) == lwc_error_ok,
+                    "Failure interning 'ONE'");
+        fail_unless(lwc_string_caseless_isequal(intern_one, new_ONE, &result) == lwc_error_ok);
+        fail_unless(result == true, "'one' !~= 'ONE' ?!");
+        fail_unless(lwc_string_caseless_isequal(intern_two, new_ONE, &result) == lwc_error_ok);
+        fail_unless(result == false, "'two' ~= 'ONE' ?!");
+
+        fail_unless(lwc_string_caseless_hash_value(new_ONE, &hash1) == lwc_error_ok);
+        fail_unless(lwc_string_caseless_hash_value(intern_one, &hash2) == lwc_error_ok);
+        fail_unless(hash1 == hash2, "Caseless hashes differ");
+        fail_unless(hash1 == lwc_calculate_hash("one", 3),
+                    "Caseless hash isn't the hash of the lower case string");
+
+        /* The four strings of the context, and ONE */
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 5, "Caseless forms were interned");
+
+        lwc_string_unref(new_ONE);
+}
+END_TEST
+
 START_TEST (test_lwc_string_caseless_isequal_bad)
 {
         bool result = true;
@@ -320,6 +731,20 @@ START_TEST (test_lwc_string_hash_value_ok)
 }
 END_TEST
 
+START_TEST (test_lwc_string_full_hash_value_ok)
+{
+        fail_unless(sizeof(lwc_string_hash_value(intern_one)) == 4,
+                    "Hash value accessor is not 32 bits wide");
+        fail_unless(lwc_string_full_hash_value(intern_one) ==
+                    lwc_calculate_hash("one", 3),
+                    "Full hash differs from calculated hash");
+#ifdef LWC_HASH_64
+        fail_unless(sizeof(lwc_string_full_hash_value(intern_one)) == 8,
+                    "Full hash value is not 64 bits wide");
+#endif
+}
+END_TEST
+
 START_TEST (test_lwc_string_is_nul_terminated)
 {
         lwc_string *new_ONE;
@@ -383,19 +808,905 @@ START_TEST (test_lwc_string_tolower_ok2)
 }
 END_TEST
 
+START_TEST (test_lwc_string_iteration)
+{
+        int counter = 0;
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 4, "Incorrect string count");
+}
+END_TEST
+
+/* Keys long enough that recursing down the prefix index would be deep */
+#define PREFIX_DEPTH 2048
+
+START_TEST (test_lwc_prefix_deep)
+{
+        static lwc_string *chain[PREFIX_DEPTH], *fork[PREFIX_DEPTH];
+        static char buf[PREFIX_DEPTH + 1];
+        int counter, i;
+
+        memset(buf, 'a', sizeof(buf));
+
+        /* Every "a..a" holds a string and forks to "a..ab" as well */
+        for (i = 0; i < PREFIX_DEPTH; i++) {
+                fail_unless(lwc_intern_string(buf, i + 1, &chain[i]) == lwc_error_ok);
+                buf[i + 1] = 'b';
+                fail_unless(lwc_intern_string(buf, i + 2, &fork[i]) == lwc_error_ok);
+                buf[i + 1] = 'a';
+
+                /* Build the index half way, and maintain it after */
+                if (i == PREFIX_DEPTH / 2) {
+                        counter = 0;
+                        lwc_iterate_prefix("a", 1, counting_cb, (void*)&counter);
+                        fail_unless(counter == 2 * (i + 1), "Incorrect count while building");
+                }
+        }
+
+        counter = 0;
+        lwc_iterate_prefix(buf, 100, counting_cb, (void*)&counter);
+        fail_unless(counter == 2 * (PREFIX_DEPTH - 99), "Incorrect count for a deep prefix");
+
+        /* Remove every other level, which leaves nodes to merge */
+        for (i = 0; i < PREFIX_DEPTH; i += 2)
+                lwc_string_unref(chain[i]);
+
+        counter = 0;
+        lwc_iterate_prefix("a", 1, counting_cb, (void*)&counter);
+        fail_unless(counter == PREFIX_DEPTH + PREFIX_DEPTH / 2, "Incorrect count after removal");
+        counter = 0;
+        lwc_iterate_prefix(buf, PREFIX_DEPTH, counting_cb, (void*)&counter);
+        fail_unless(counter == 2, "Incorrect count for the deepest prefix");
+
+        for (i = 0; i < PREFIX_DEPTH; i++) {
+                if (i % 2 == 1)
+                        lwc_string_unref(chain[i]);
+                lwc_string_unref(fork[i]);
+        }
+
+        counter = 0;
+        lwc_iterate_prefix("a", 1, counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Strings left in the index");
+}
+END_TEST
+
+START_TEST (test_lwc_prefix_iteration)
+{
+        int counter = 0;
+        lwc_iterate_prefix("t", 1, counting_cb, (void*)&counter);
+        fail_unless(counter == 2, "Incorrect count for 't'");
+        counter = 0;
+        lwc_iterate_prefix("th", 2, counting_cb, (void*)&counter);
+        fail_unless(counter == 1, "Incorrect count for 'th'");
+        counter = 0;
+        lwc_iterate_prefix("three", 5, counting_cb, (void*)&counter);
+        fail_unless(counter == 1, "Incorrect count for 'three'");
+        counter = 0;
+        lwc_iterate_prefix("threes", 6, counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Incorrect count for 'threes'");
+        counter = 0;
+        lwc_iterate_prefix("x", 1, counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Incorrect count for 'x'");
+        counter = 0;
+        lwc_iterate_prefix(NULL, 0, counting_cb, (void*)&counter);
+        fail_unless(counter == 4, "Incorrect count for empty prefix");
+}
+END_TEST
+
+START_TEST (test_lwc_prefix_iteration_maintained)
+{
+        int counter = 0;
+        lwc_string *thr, *throw, *tw;
+
+        /* Build the index before adding more strings */
+        lwc_iterate_prefix("t", 1, counting_cb, (void*)&counter);
+        fail_unless(counter == 2, "Incorrect count for 't'");
+
+        fail_unless(lwc_intern_string("thr", 3, &thr) == lwc_error_ok);
+        fail_unless(lwc_intern_string("throw", 5, &throw) == lwc_error_ok);
+        fail_unless(lwc_intern_string("tw", 2, &tw) == lwc_error_ok);
+
+        counter = 0;
+        lwc_iterate_prefix("thr", 3, counting_cb, (void*)&counter);
+        fail_unless(counter == 3, "Incorrect count for 'thr'");
+        counter = 0;
+        lwc_iterate_prefix("tw", 2, counting_cb, (void*)&counter);
+        fail_unless(counter == 2, "Incorrect count for 'tw'");
+
+        lwc_string_unref(thr);
+        lwc_string_unref(tw);
+
+        counter = 0;
+        lwc_iterate_prefix("thr", 3, counting_cb, (void*)&counter);
+        fail_unless(counter == 2, "Incorrect count for 'thr' after unref");
+        counter = 0;
+        lwc_iterate_prefix("t", 1, counting_cb, (void*)&counter);
+        fail_unless(counter == 3, "Incorrect count for 't' after unref");
+
+        lwc_string_unref(throw);
+
+        counter = 0;
+        lwc_iterate_prefix("thr", 3, counting_cb, (void*)&counter);
+        fail_unless(counter == 1, "Incorrect count for 'thr' at the end");
+}
+END_TEST
+
+#ifdef LWC_WITH_TRACE
+static int trace_counts[lwc_trace_op_count];
+
 static void
-counting_cb(lwc_string *str, void *pw)
+tracing_cb(lwc_trace_op op, lwc_string *str, void *pw)
 {
         UNUSED(str);
-        
-        *((int *)pw) += 1;
+        UNUSED(pw);
+
+        trace_counts[op]++;
 }
 
-START_TEST (test_lwc_string_iteration)
+START_TEST (test_lwc_trace_callback)
+{
+        lwc_string *new_one, *new_ONE, *lower;
+        uint64_t hist[LWC_TRACE_HISTOGRAM_SIZE];
+        uint64_t total = 0;
+        int i;
+
+        fail_unless(lwc_set_trace_callback(tracing_cb, NULL, 1) == lwc_error_ok);
+
+        fail_unless(lwc_intern_string("one", 3, &new_one) == lwc_error_ok);
+        fail_unless(lwc_intern_string("ONE", 3, &new_ONE) == lwc_error_ok);
+        fail_unless(lwc_string_tolower(new_one, &lower) == lwc_error_ok);
+        lwc_string_unref(lower);
+        fail_unless(lwc_string_tolower(new_ONE, &lower) == lwc_error_ok);
+        lwc_string_unref(lower);
+        lwc_string_unref(new_ONE);
+        (void) lwc_collect();
+
+        fail_unless(lwc_set_trace_callback(NULL, NULL, 0) == lwc_error_ok);
+
+        fail_unless(trace_counts[lwc_trace_intern_hit] == 3,
+                    "Incorrect number of interning hits traced");
+        fail_unless(trace_counts[lwc_trace_intern_miss] == 1,
+                    "Incorrect number of interning misses traced");
+        fail_unless(trace_counts[lwc_trace_intern_caseless] == 2,
+                    "Incorrect number of caseless internings traced");
+        fail_unless(trace_counts[lwc_trace_destroy] == 1,
+                    "Incorrect number of destructions traced");
+
+        /* The hits made by the caseless internings are timed as those */
+        fail_unless(lwc_trace_histogram(lwc_trace_intern_hit, hist) == lwc_error_ok);
+        for (i = 0; i < LWC_TRACE_HISTOGRAM_SIZE; i++)
+                total += hist[i];
+        fail_unless(total == 1, "Incorrect number of hits timed");
+
+        fail_unless(lwc_trace_histogram(lwc_trace_destroy, hist) == lwc_error_ok);
+        for (i = 0, total = 0; i < LWC_TRACE_HISTOGRAM_SIZE; i++)
+                total += hist[i];
+        fail_unless(total == 1, "Incorrect number of destructions timed");
+}
+END_TEST
+
+START_TEST (test_lwc_trace_sampled)
 {
+        uint64_t before[LWC_TRACE_HISTOGRAM_SIZE], after[LWC_TRACE_HISTOGRAM_SIZE];
+        uint64_t total = 0;
+        lwc_string *str;
+        int i;
+
+        fail_unless(lwc_trace_histogram(lwc_trace_intern_hit, before) == lwc_error_ok);
+        fail_unless(lwc_set_trace_callback(NULL, NULL, 2) == lwc_error_ok);
+
+        for (i = 0; i < 10; i++) {
+                fail_unless(lwc_intern_string("one", 3, &str) == lwc_error_ok);
+                lwc_string_unref(str);
+        }
+
+        fail_unless(lwc_set_trace_callback(NULL, NULL, 0) == lwc_error_ok);
+
+        fail_unless(lwc_trace_histogram(lwc_trace_intern_hit, after) == lwc_error_ok);
+        for (i = 0; i < LWC_TRACE_HISTOGRAM_SIZE; i++)
+                total += after[i] - before[i];
+        fail_unless(total == 5, "Every other hit should be timed");
+}
+END_TEST
+#else
+START_TEST (test_lwc_trace_unsupported)
+{
+        fail_unless(lwc_set_trace_callback(NULL, NULL, 0) == lwc_error_unsupported);
+}
+END_TEST
+#endif
+
+#ifdef LWC_WITH_RECORD
+START_TEST (test_lwc_record_replay)
+{
+        lwc_string *before, *again, *str, *sub, *lower;
+        lwc_replay_stats stats[LWC_REPLAY_STATS_SIZE];
+        FILE *f = tmpfile();
         int counter = 0;
+        bool result;
+
+        fail_unless(f != NULL, "Unable to create trace file");
+
+        /* Interned before recording starts, so adopted by the trace */
+        fail_unless(lwc_intern_string("Adopted", 7, &before) == lwc_error_ok);
+
+        fail_unless(lwc_record_start(fileno(f)) == lwc_error_ok);
+        fail_unless(lwc_record_start(fileno(f)) == lwc_error_busy);
+        fail_unless(lwc_set_allocator(NULL, NULL, NULL, NULL) ==
+                    lwc_error_busy);
+
+        fail_unless(lwc_intern_string("Recorded", 8, &str) == lwc_error_ok);
+        fail_unless(lwc_intern_substring(str, 2, 4, &sub) == lwc_error_ok);
+        fail_unless(lwc_string_tolower(str, &lower) == lwc_error_ok);
+        fail_unless(lwc_string_caseless_isequal(str, lower, &result) ==
+                    lwc_error_ok);
+        fail_unless(result == true);
+        again = lwc_string_ref(before);
+
+        lwc_string_unref(again);
+        lwc_string_unref(before);
+        lwc_string_unref(sub);
+        lwc_string_unref(lower);
+        lwc_string_unref(str);
+
+        fail_unless(lwc_record_stop() == lwc_error_ok);
+        fail_unless(lwc_record_stop() == lwc_error_invalid);
+
         lwc_iterate_strings(counting_cb, (void*)&counter);
-        fail_unless(counter == 4, "Incorrect string count");
+        fail_unless(counter == 0, "Strings were left after recording");
+
+        fail_unless(lseek(fileno(f), 0, SEEK_SET) == 0);
+        fail_unless(lwc_replay(fileno(f), stats) == lwc_error_ok);
+
+        fail_unless(stats[lwc_replay_intern].calls == 1);
+        fail_unless(stats[lwc_replay_substring].calls == 1);
+        fail_unless(stats[lwc_replay_tolower].calls == 1);
+        fail_unless(stats[lwc_replay_caseless].calls == 1);
+        fail_unless(stats[lwc_replay_ref].calls == 1);
+        fail_unless(stats[lwc_replay_unref].calls == 4,
+                    "Unref of an adopted string was replayed");
+        fail_unless(stats[lwc_replay_op_count].calls == 9);
+        fail_unless(stats[lwc_replay_op_count].max >=
+                    stats[lwc_replay_op_count].p50);
+
+        counter = 0;
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Strings were left after replay");
+
+        fclose(f);
+}
+END_TEST
+
+START_TEST (test_lwc_record_write_failed)
+{
+        lwc_string *str;
+        int fds[2];
+
+        fail_unless(pipe(fds) == 0, "Unable to create pipe");
+
+        /* The read end of a pipe can't be written to */
+        fail_unless(lwc_record_start(fds[0]) == lwc_error_ok);
+        fail_unless(lwc_intern_string("Lost", 4, &str) == lwc_error_ok);
+        lwc_string_unref(str);
+        fail_unless(lwc_record_stop() == lwc_error_io);
+
+        close(fds[0]);
+        close(fds[1]);
+}
+END_TEST
+#else
+START_TEST (test_lwc_record_unsupported)
+{
+        fail_unless(lwc_record_start(-1) == lwc_error_unsupported);
+        fail_unless(lwc_record_stop() == lwc_error_unsupported);
+}
+END_TEST
+#endif
+
+START_TEST (test_lwc_replay_invalid)
+{
+        static const char *const traces[] = {
+                "Hello",                /* Not a trace at all */
+                "LWCR\x7f",             /* From a later version */
+                "LWCR\x01\x7f",         /* Unknown call */
+                "LWCR\x01\x01\x01\x09" /* Truncated string */
+        };
+        lwc_replay_stats stats[LWC_REPLAY_STATS_SIZE];
+        size_t i;
+
+        for (i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+                FILE *f = tmpfile();
+
+                fail_unless(f != NULL, "Unable to create trace file");
+                fputs(traces[i], f);
+                fflush(f);
+                fail_unless(lseek(fileno(f), 0, SEEK_SET) == 0);
+                fail_unless(lwc_replay(fileno(f), stats) ==
+                            lwc_error_invalid,
+                            "Trace %zu was replayed", i);
+                fclose(f);
+        }
+}
+END_TEST
+
+START_TEST (test_lwc_intern_split)
+{
+        static const char classes[] = "  nav\tbutton-primary-large nav\n";
+        static const char selectors[] = "a:hover,h1 , .https-example-org;p";
+        static const char mixed[] = "Nav Button-Primary-Large-XL navBAR";
+        lwc_string *strs[4], *nav;
+        size_t count = 4, calls = 0, i;
+        int counter = 0;
+
+        fail_unless(lwc_intern_split(classes, sizeof(classes) - 1, " \t\n",
+                                     strs, &count) == lwc_error_ok);
+        fail_unless(count == 3, "Incorrect number of tokens");
+        fail_unless(lwc_intern_string("nav", 3, &nav) == lwc_error_ok);
+        fail_unless(strs[0] == nav && strs[2] == nav, "Token not interned");
+        fail_unless(lwc_string_length(strs[1]) == 20);
+        fail_unless(memcmp(lwc_string_data(strs[1]), "button-primary-large", 21) == 0);
+        lwc_string_unref(nav);
+        lwc_string_unref_many(strs, count);
+
+        /* More delimiters than are searched for a word at a time */
+        count = 4;
+        fail_unless(lwc_intern_split(selectors, sizeof(selectors) - 1,
+                                     " ,;!?|+~>", strs, &count) == lwc_error_ok);
+        fail_unless(count == 4, "Incorrect number of tokens");
+        fail_unless(lwc_string_length(strs[2]) == 18);
+        fail_unless(memcmp(lwc_string_data(strs[3]), "p", 2) == 0);
+        lwc_string_unref_many(strs, count);
+
+        /* Tokens are hashed as they are scanned, short or long */
+        count = 4;
+        fail_unless(lwc_intern_split(mixed, sizeof(mixed) - 1, " ",
+                                     strs, &count) == lwc_error_ok);
+        fail_unless(count == 3, "Incorrect number of tokens");
+        for (i = 0; i < count; i++) {
+                const char *data = lwc_string_data(strs[i]);
+                size_t len = lwc_string_length(strs[i]);
+                lwc_string *same, *lower;
+                lwc_hash chash;
+
+                fail_unless(lwc_intern_string(data, len, &same) == lwc_error_ok);
+                fail_unless(same == strs[i], "Token not interned");
+                fail_unless(lwc_string_full_hash_value(strs[i]) ==
+                            lwc_calculate_hash(data, len), "Token hashed differently");
+                fail_unless(lwc_string_tolower(strs[i], &lower) == lwc_error_ok);
+                fail_unless(lwc_string_caseless_hash_value(strs[i], &chash) ==
+                            lwc_error_ok);
+                fail_unless(chash == lwc_string_full_hash_value(lower),
+                            "Token caseless hash differs");
+                lwc_string_unref(lower);
+                lwc_string_unref(same);
+        }
+        lwc_string_unref_many(strs, count);
+
+        /* Out of room, nothing is interned at all */
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        counter = 0;
+        fail_unless(lwc_set_allocator(counting_alloc, NULL,
+                                      counting_sized_free, &calls) == lwc_error_ok);
+        count = 2;
+        fail_unless(lwc_intern_split(selectors, sizeof(selectors) - 1, ",;",
+                                     strs, &count) == lwc_error_range);
+        fail_unless(count == 4, "Incorrect number of tokens needed");
+        count = 0;
+        fail_unless(lwc_intern_split("a b", 3, " ", NULL, &count) ==
+                    lwc_error_range);
+        fail_unless(count == 2, "Incorrect number of tokens needed");
+        fail_unless(calls == 0, "Tokens were interned without room");
+        fail_unless(lwc_set_allocator(NULL, NULL, NULL, NULL) == lwc_error_ok);
+
+        count = 0;
+        fail_unless(lwc_intern_split(" \t ", 3, " \t", NULL, &count) == lwc_error_ok);
+        fail_unless(count == 0, "Empty tokens were interned");
+
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Tokens were leaked");
+}
+END_TEST
+
+/* Pairs of strings which differ only in case, upper case first */
+static const char *const fold_pairs[][2] = {
+        { "\xc3\x85NGSTR\xc3\x96M", "\xc3\xa5ngstr\xc3\xb6m" },
+        { "\xe2\x84\xaa", "k" },                        /* Kelvin sign */
+        { "STRA\xe1\xba\x9e" "E", "stra\xc3\x9f" "e" },       /* Capital sharp s */
+        { "\xc8\xba" "B", "\xe2\xb1\xa5" "b" },                /* Grows when folded */
+        { "\xce\xa3\xce\x8a\xce\xa3\xce\xa5\xce\xa6\xce\x9f\xce\xa3 \xce\x9a\xce\x91\xce\x99 \xce\x97 \xce\xa0\xce\x95\xce\xa4\xce\xa1\xce\x91",
+          "\xcf\x83\xce\xaf\xcf\x83\xcf\x85\xcf\x86\xce\xbf\xcf\x82 \xce\xba\xce\xb1\xce\xb9 \xce\xb7 \xcf\x80\xce\xb5\xcf\x84\xcf\x81\xce\xb1" },
+        { "\xff\xc3Z\xed\xa0\x80", "\xff\xc3z\xed\xa0\x80" }   /* Not UTF-8 */
+};
+
+#ifdef LWC_UNICODE_FOLD
+START_TEST (test_lwc_unicode_fold)
+{
+        lwc_string *upper, *lower, *folded, *other;
+        size_t i;
+        bool result;
+
+        for (i = 0; i < sizeof(fold_pairs) / sizeof(fold_pairs[0]); i++) {
+                const char *u = fold_pairs[i][0], *l = fold_pairs[i][1];
+
+                fail_unless(lwc_intern_string(u, strlen(u), &upper) == lwc_error_ok);
+                fail_unless(lwc_intern_string(l, strlen(l), &lower) == lwc_error_ok);
+
+                fail_unless(lwc_string_caseless_isequal(upper, lower, &result) == lwc_error_ok);
+                fail_unless(result == true, "Pair %zu not caselessly equal", i);
+
+                /* The last pair's lower case form is not its folded one */
+                fail_unless(lwc_string_tolower(upper, &folded) == lwc_error_ok);
+                if (i < 4)
+                        fail_unless(folded == lower, "Pair %zu folded wrongly", i);
+                fail_unless(lwc_string_caseless_isequal(folded, lower, &result) == lwc_error_ok);
+                fail_unless(result == true);
+                lwc_string_unref(folded);
+
+                lwc_string_unref(lower);
+                lwc_string_unref(upper);
+        }
+
+        /* Simple folding keeps one character to one */
+        fail_unless(lwc_intern_string("STRA\xe1\xba\x9e" "E", 8, &upper) == lwc_error_ok);
+        fail_unless(lwc_intern_string("strasse", 7, &other) == lwc_error_ok);
+        fail_unless(lwc_string_caseless_isequal(upper, other, &result) == lwc_error_ok);
+        fail_unless(result == false, "Sharp s was fully folded");
+        lwc_string_unref(other);
+        lwc_string_unref(upper);
+}
+END_TEST
+#else
+START_TEST (test_lwc_ascii_fold)
+{
+        lwc_string *upper, *lower;
+        bool result;
+
+        fail_unless(lwc_intern_string(fold_pairs[0][0], strlen(fold_pairs[0][0]), &upper) == lwc_error_ok);
+        fail_unless(lwc_intern_string(fold_pairs[0][1], strlen(fold_pairs[0][1]), &lower) == lwc_error_ok);
+        fail_unless(lwc_string_caseless_isequal(upper, lower, &result) == lwc_error_ok);
+        fail_unless(result == false, "Non-ASCII letters were folded");
+        lwc_string_unref(lower);
+        lwc_string_unref(upper);
+}
+END_TEST
+#endif
+
+START_TEST (test_lwc_table_round_trip)
+{
+        static const char url[] = "https://www.example.org/Assets/Index.html";
+        lwc_string *strs[5], *out[4], *again;
+        uint32_t indices[5];
+        unsigned char *table;
+        size_t size = 0, count = 0, i;
+        int counter = 0;
+
+        fail_unless(lwc_intern_string("Hello", 5, &strs[0]) == lwc_error_ok);
+        fail_unless(lwc_intern_string("world", 5, &strs[1]) == lwc_error_ok);
+        fail_unless(lwc_intern_string(url, sizeof(url) - 1, &strs[2]) == lwc_error_ok);
+        strs[3] = lwc_string_ref(strs[0]);
+        fail_unless(lwc_intern_string("", 0, &strs[4]) == lwc_error_ok);
+
+        fail_unless(lwc_table_encode(strs, 5, indices, NULL, &size) == lwc_error_range);
+        table = malloc(size);
+        fail_unless(table != NULL);
+        size--;
+        fail_unless(lwc_table_encode(strs, 5, NULL, table, &size) == lwc_error_range);
+        fail_unless(lwc_table_encode(strs, 5, indices, table, &size) == lwc_error_ok);
+
+        fail_unless(indices[0] == 0 && indices[1] == 1 && indices[2] == 2 &&
+                    indices[3] == 0 && indices[4] == 3,
+                    "Incorrect table indices");
+
+        /* Only Hello survives to be found again */
+        for (i = 1; i < 5; i++)
+                lwc_string_unref(strs[i]);
+
+        fail_unless(lwc_table_decode(table, size, NULL, &count) == lwc_error_range);
+        fail_unless(count == 4, "Incorrect table size");
+        count = 3;
+        fail_unless(lwc_table_decode(table, size, out, &count) == lwc_error_range);
+        fail_unless(lwc_table_decode(table, size, out, &count) == lwc_error_ok);
+        fail_unless(count == 4);
+
+        fail_unless(out[0] == strs[0], "Live string was not found");
+        fail_unless(lwc_string_length(out[2]) == sizeof(url) - 1);
+        fail_unless(memcmp(lwc_string_data(out[2]), url, sizeof(url)) == 0);
+        fail_unless(lwc_string_length(out[3]) == 0);
+        fail_unless(lwc_intern_string("world", 5, &again) == lwc_error_ok);
+        fail_unless(again == out[1], "Decoded string was not interned");
+        lwc_string_unref(again);
+        fail_unless(lwc_intern_string(url, sizeof(url) - 1, &again) == lwc_error_ok);
+        fail_unless(again == out[2], "Decoded string was stored with the wrong hash");
+        lwc_string_unref(again);
+        lwc_string_unref_many(out, 4);
+
+        /* From another process */
+        table[6] ^= 0xff;
+        count = 4;
+        fail_unless(lwc_table_decode(table, size, out, &count) == lwc_error_ok);
+        fail_unless(lwc_intern_string(url, sizeof(url) - 1, &again) == lwc_error_ok);
+        fail_unless(again == out[2], "Rehashed string was not interned");
+        lwc_string_unref(again);
+        lwc_string_unref_many(out, 4);
+        table[6] ^= 0xff;
+
+        /* Stored hashes which don't match the string are not believed */
+        for (i = 0; memcmp(table + i, url, sizeof(url) - 1) != 0; i++)
+                ;
+        table[i - 2 * sizeof(lwc_hash)] ^= 0x5a;
+        table[i - sizeof(lwc_hash)] ^= 0x5a;
+        count = 4;
+        fail_unless(lwc_table_decode(table, size, out, &count) == lwc_error_ok);
+        fail_unless(lwc_intern_string(url, sizeof(url) - 1, &again) == lwc_error_ok);
+        fail_unless(again == out[2], "String was interned under a stored hash");
+        lwc_string_unref(again);
+        lwc_string_unref_many(out, 4);
+
+        /* Tables which are cut short or run on intern nothing */
+        lwc_string_unref(strs[0]);
+        fail_unless(lwc_table_decode(table, size - 1, out, &count) == lwc_error_invalid);
+        fail_unless(lwc_table_decode(table, 5, out, &count) == lwc_error_invalid);
+        table = realloc(table, size + 1);
+        fail_unless(table != NULL);
+        fail_unless(lwc_table_decode(table, size + 1, out, &count) == lwc_error_invalid);
+
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 0, "Strings were left by a bad table");
+
+        free(table);
+}
+END_TEST
+
+#ifdef LWC_WITH_SHM
+START_TEST (test_lwc_shm_publish_attach)
+{
+        lwc_string *hello, *world, *shared, *again, *HELLO;
+        FILE *f = tmpfile();
+        int counter = 0;
+        bool result;
+
+        fail_unless(f != NULL, "Unable to create segment file");
+
+        fail_unless(lwc_intern_string("Hello", 5, &hello) == lwc_error_ok);
+        fail_unless(lwc_intern_string("world", 5, &world) == lwc_error_ok);
+        fail_unless(lwc_shm_publish(fileno(f)) == lwc_error_ok);
+        lwc_string_unref(hello);
+        lwc_string_unref(world);
+
+        fail_unless(lwc_shm_attach(fileno(f)) == lwc_error_ok);
+        fail_unless(lwc_shm_attach(fileno(f)) == lwc_error_busy);
+
+        fail_unless(lwc_intern_string("Hello", 5, &shared) == lwc_error_ok);
+        fail_unless(lwc_intern_string("Hello", 5, &again) == lwc_error_ok);
+        fail_unless(shared == again, "Shared string not found twice");
+        fail_unless(lwc_string_length(shared) == 5);
+        fail_unless(memcmp(lwc_string_data(shared), "Hello", 6) == 0);
+
+        fail_unless(lwc_intern_string("HELLO", 5, &HELLO) == lwc_error_ok);
+        fail_unless(lwc_string_caseless_isequal(shared, HELLO, &result) == lwc_error_ok);
+        fail_unless(result == true, "Caseless comparison with shared string failed");
+
+        /* Hello, hello and world are shared, HELLO is private */
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 4, "Incorrect string count with segment");
+
+        counter = 0;
+        lwc_iterate_prefix("he", 2, counting_cb, (void*)&counter);
+        fail_unless(counter == 1, "Incorrect prefix count with segment");
+
+        lwc_string_unref(HELLO);
+        lwc_string_unref(again);
+        lwc_string_unref(shared);
+
+        counter = 0;
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == 3, "Shared strings were destroyed");
+
+        fclose(f);
+}
+END_TEST
+
+/* Write a copy of a segment, with a 64 bit word of it replaced */
+static FILE *
+shm_corrupt_copy(const char *seg, size_t size, size_t offset, uint64_t value)
+{
+        FILE *f = tmpfile();
+
+        fail_unless(f != NULL, "Unable to create segment file");
+        fail_unless(fwrite(seg, 1, size, f) == size);
+        fail_unless(fseek(f, (long)offset, SEEK_SET) == 0);
+        fail_unless(fwrite(&value, sizeof(value), 1, f) == 1);
+        fail_unless(fflush(f) == 0);
+
+        return f;
+}
+
+START_TEST (test_lwc_shm_attach_invalid)
+{
+        /* Offsets into the segment header, and of a string's state in
+         * its record, which follows the record's next and caseless
+         * offsets and comes before or inside the string */
+        const size_t size_at = 16, bucketcount_at = 64, buckets_at = 72;
+        const size_t insensitive_at = sizeof(uint64_t);
+        const size_t state_at = 2 * sizeof(uint64_t);
+        lwc_string *hello, *world;
+        uint64_t size, buckets, bucketcount, head = 0, n;
+        char *seg;
+        FILE *f = tmpfile(), *bad;
+        struct {
+                size_t offset;
+                uint64_t value;
+        } corrupt[7];
+        size_t i;
+
+        fail_unless(f != NULL, "Unable to create segment file");
+
+        fail_unless(lwc_intern_string("Hello", 5, &hello) == lwc_error_ok);
+        fail_unless(lwc_intern_string("world", 5, &world) == lwc_error_ok);
+        fail_unless(lwc_shm_publish(fileno(f)) == lwc_error_ok);
+        lwc_string_unref(hello);
+        lwc_string_unref(world);
+
+        fail_unless(pread(fileno(f), &size, sizeof(size), size_at) == sizeof(size));
+        seg = malloc(size);
+        fail_unless(seg != NULL);
+        fail_unless(pread(fileno(f), seg, size, 0) == (ssize_t)size);
+        memcpy(&bucketcount, seg + bucketcount_at, sizeof(bucketcount));
+        memcpy(&buckets, seg + buckets_at, sizeof(buckets));
+        for (n = 0; n < bucketcount && head == 0; n++)
+                memcpy(&head, seg + buckets + n * sizeof(head), sizeof(head));
+        fail_unless(head != 0, "Segment has no strings");
+
+        /* Enough buckets that their size wraps to nothing */
+        corrupt[0].offset = bucketcount_at;
+        corrupt[0].value = UINT64_C(1) << 61;
+        /* A chain heading off the end of the segment */
+        corrupt[1].offset = buckets + (n - 1) * sizeof(head);
+        corrupt[1].value = size;
+        /* A chain which loops */
+        corrupt[2].offset = head;
+        corrupt[2].value = head;
+        /* A string longer than the segment */
+#ifdef LWC_SPLIT_LAYOUT
+        corrupt[3].offset = head + state_at + sizeof(lwc_string_state) +
+                        offsetof(lwc_string, len);
+#else
+        corrupt[3].offset = head + state_at + offsetof(lwc_string, len);
+#endif
+        corrupt[3].value = size;
+        /* A string which would be counted, and freed */
+#ifdef LWC_WITH_THREADS
+        corrupt[4].offset = head + state_at + offsetof(lwc_string_state, owner);
+        corrupt[4].value = 0;
+#else
+        corrupt[4].offset = head + state_at + offsetof(lwc_string_state, refcnt);
+        corrupt[4].value = 1;
+#endif
+        /* A caseless form off the end of the segment */
+        corrupt[5].offset = head + insensitive_at;
+        corrupt[5].value = size;
+        /* A caseless form linked by pointer */
+        corrupt[6].offset = head + state_at +
+                        offsetof(lwc_string_state, insensitive);
+        corrupt[6].value = head;
+
+        for (i = 0; i < sizeof(corrupt) / sizeof(corrupt[0]); i++) {
+                bad = shm_corrupt_copy(seg, size, corrupt[i].offset,
+                                       corrupt[i].value);
+                fail_unless(lwc_shm_attach(fileno(bad)) == lwc_error_invalid,
+                            "Corrupt segment attached");
+                fclose(bad);
+        }
+
+        fail_unless(lwc_shm_attach(fileno(f)) == lwc_error_ok,
+                    "Segment not attached after corrupt ones");
+
+        free(seg);
+        fclose(f);
+}
+END_TEST
+
+START_TEST (test_lwc_shm_attach_elsewhere)
+{
+        const size_t size_at = 16, base_at = 24;
+        lwc_string *hello, *shared, *lower, *HELLO, *again;
+        uint64_t size, base;
+        char *before, *after;
+        void *taken;
+        FILE *f = tmpfile();
+        bool result;
+
+        fail_unless(f != NULL, "Unable to create segment file");
+
+        fail_unless(lwc_intern_string("Hello", 5, &hello) == lwc_error_ok);
+        fail_unless(lwc_shm_publish(fileno(f)) == lwc_error_ok);
+        lwc_string_unref(hello);
+
+        fail_unless(pread(fileno(f), &size, sizeof(size), size_at) == sizeof(size));
+        fail_unless(pread(fileno(f), &base, sizeof(base), base_at) == sizeof(base));
+        before = malloc(size);
+        after = malloc(size);
+        fail_unless(before != NULL && after != NULL);
+        fail_unless(pread(fileno(f), before, size, 0) == (ssize_t)size);
+
+        /* Keep the segment from going where its publisher had it */
+        taken = mmap((void *)(uintptr_t)base, size, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        fail_unless((uintptr_t)taken == base, "Publisher's address is taken");
+
+#ifdef LWC_SPLIT_LAYOUT
+        fail_unless(lwc_shm_attach(fileno(f)) == lwc_error_unshared,
+                    "Private copy of segment not reported");
+#else
+        fail_unless(lwc_shm_attach(fileno(f)) == lwc_error_ok);
+#endif
+
+        fail_unless(lwc_intern_string("Hello", 5, &shared) == lwc_error_ok);
+        fail_unless(lwc_intern_string("HELLO", 5, &HELLO) == lwc_error_ok);
+        fail_unless(lwc_string_caseless_isequal(shared, HELLO, &result) == lwc_error_ok);
+        fail_unless(result == true, "Caseless comparison with shared string failed");
+        fail_unless(lwc_string_tolower(shared, &lower) == lwc_error_ok);
+        fail_unless(lwc_intern_string("hello", 5, &again) == lwc_error_ok);
+        fail_unless(lower == again, "Shared caseless form not linked");
+        fail_unless(lwc_string_caseless_isequal(lower, HELLO, &result) == lwc_error_ok);
+        fail_unless(result == true, "Caseless comparison with shared form failed");
+
+        lwc_string_unref(again);
+        lwc_string_unref(lower);
+        lwc_string_unref(HELLO);
+        lwc_string_unref(shared);
+
+        fail_unless(pread(fileno(f), after, size, 0) == (ssize_t)size);
+        fail_unless(memcmp(before, after, size) == 0, "Segment was written");
+
+        munmap(taken, size);
+        free(after);
+        free(before);
+        fclose(f);
+}
+END_TEST
+#else
+START_TEST (test_lwc_shm_unsupported)
+{
+        fail_unless(lwc_shm_publish(-1) == lwc_error_unsupported);
+        fail_unless(lwc_shm_attach(-1) == lwc_error_unsupported);
+}
+END_TEST
+#endif
+
+#if LWC_USER_SLOTS > 0
+static int user_data_destroyed;
+
+static void
+user_data_destructor(lwc_string *str, void *data, void *pw)
+{
+        UNUSED(str);
+
+        fail_unless(data == pw, "Wrong data passed to destructor");
+        user_data_destroyed++;
+}
+
+START_TEST (test_lwc_user_data)
+{
+        lwc_string *str, *again;
+        unsigned int slot;
+        int data = 0, other = 0;
+
+        fail_unless(lwc_register_user_slot(user_data_destructor, &data,
+                                           &slot) == lwc_error_ok);
+        fail_unless(slot < LWC_USER_SLOTS);
+
+        fail_unless(lwc_intern_string("meta", 4, &str) == lwc_error_ok);
+        fail_unless(lwc_string_user_data(str, slot) == NULL,
+                    "New string has user data");
+        fail_unless(lwc_string_set_user_data(str, slot, &data) == lwc_error_ok);
+        fail_unless(lwc_string_set_user_data(str, slot, &other) == lwc_error_busy,
+                    "User data was replaced");
+        fail_unless(lwc_string_set_user_data(str, LWC_USER_SLOTS, &data) ==
+                    lwc_error_range);
+
+        fail_unless(lwc_intern_string("meta", 4, &again) == lwc_error_ok);
+        fail_unless(lwc_string_user_data(again, slot) == &data,
+                    "User data lost on re-interning");
+
+        user_data_destroyed = 0;
+        lwc_string_unref(again);
+        lwc_string_unref(str);
+        (void) lwc_collect();
+        fail_unless(user_data_destroyed == 1, "Destructor not called once");
+}
+END_TEST
+#else
+START_TEST (test_lwc_user_data_unsupported)
+{
+        lwc_string *str;
+        unsigned int slot;
+
+        fail_unless(lwc_register_user_slot(NULL, NULL, &slot) ==
+                    lwc_error_unsupported);
+
+        fail_unless(lwc_intern_string("meta", 4, &str) == lwc_error_ok);
+        fail_unless(lwc_string_user_data(str, 0) == NULL);
+        fail_unless(lwc_string_set_user_data(str, 0, str) ==
+                    lwc_error_unsupported);
+        lwc_string_unref(str);
+}
+END_TEST
+#endif
+
+#ifdef LWC_SPLIT_LAYOUT
+START_TEST (test_lwc_split_layout)
+{
+        lwc_string *str, *again, *lower;
+        unsigned char before[sizeof(lwc_string) + 8];
+
+        fail_unless(lwc_intern_string("Fork me", 7, &str) == lwc_error_ok);
+        memcpy(before, str, sizeof(before));
+
+        /* None of this may write to the string itself */
+        fail_unless(lwc_intern_string("Fork me", 7, &again) == lwc_error_ok);
+        fail_unless(lwc_string_tolower(str, &lower) == lwc_error_ok);
+        fail_unless(lwc_string_ref(str) == str);
+        lwc_string_unref(again);
+
+        fail_unless(memcmp(before, str, sizeof(before)) == 0,
+                    "String written after interning");
+
+        lwc_string_unref(lower);
+        lwc_string_unref(str);
+        lwc_string_unref(str);
+}
+END_TEST
+#endif
+
+#define FROZEN_COUNT (200)
+
+START_TEST (test_lwc_freeze)
+{
+        lwc_string *strs[FROZEN_COUNT], *mixed, *again, *later, *MIXED;
+        char buf[16];
+        int counter = 0;
+        bool result;
+        int i;
+
+        for (i = 0; i < FROZEN_COUNT; i++) {
+                sprintf(buf, "k%d", i);
+                fail_unless(lwc_intern_string(buf, strlen(buf), &strs[i]) == lwc_error_ok);
+        }
+        fail_unless(lwc_intern_string("Mixed", 5, &mixed) == lwc_error_ok);
+
+        fail_unless(lwc_freeze() == lwc_error_ok, "Unable to freeze");
+        fail_unless(lwc_freeze() == lwc_error_busy, "Froze twice");
+
+        for (i = 0; i < FROZEN_COUNT; i++) {
+                sprintf(buf, "k%d", i);
+                fail_unless(lwc_intern_string(buf, strlen(buf), &again) == lwc_error_ok);
+                fail_unless(again == strs[i], "Frozen string not found");
+                lwc_string_unref(again);
+        }
+
+        /* New strings go in the ordinary table */
+        fail_unless(lwc_intern_string("later", 5, &later) == lwc_error_ok);
+        fail_unless(lwc_intern_string("later", 5, &again) == lwc_error_ok);
+        fail_unless(later == again, "Unfrozen string not found twice");
+        lwc_string_unref(again);
+
+        fail_unless(lwc_intern_string("MIXED", 5, &MIXED) == lwc_error_ok);
+        fail_unless(lwc_string_caseless_isequal(mixed, MIXED, &result) == lwc_error_ok);
+        fail_unless(result == true, "Caseless comparison with frozen string failed");
+
+        lwc_string_unref(MIXED);
+        lwc_string_unref(later);
+        lwc_string_unref(mixed);
+        for (i = 0; i < FROZEN_COUNT; i++)
+                lwc_string_unref(strs[i]);
+
+        /* The keys, Mixed and mixed */
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == FROZEN_COUNT + 2, "Frozen strings were destroyed");
+
+        counter = 0;
+        lwc_iterate_prefix("k1", 2, counting_cb, (void*)&counter);
+        fail_unless(counter == 111, "Incorrect prefix count with frozen strings");
 }
 END_TEST
 
@@ -452,6 +1763,47 @@ lwc_basic_suite(SRunner *sr)
         tcase_add_test(tc_basic, test_lwc_intern_string_ok);
         tcase_add_test(tc_basic, test_lwc_intern_string_twice_ok);
         tcase_add_test(tc_basic, test_lwc_intern_string_twice_same_ok);
+        tcase_add_test(tc_basic, test_lwc_intern_many_ok);
+        tcase_add_test(tc_basic, test_lwc_rekey);
+        tcase_add_test(tc_basic, test_lwc_string_unref_many_ok);
+        tcase_add_test(tc_basic, test_lwc_short_strings);
+        tcase_add_test(tc_basic, test_lwc_prefix_deep);
+        tcase_add_test(tc_basic, test_lwc_deferred_reclaim);
+        tcase_add_test(tc_basic, test_lwc_background_reclaim);
+#ifdef LWC_WITH_THREADS
+        tcase_add_test(tc_basic, test_lwc_threaded_refcounting);
+#endif
+        tcase_add_test(tc_basic, test_lwc_set_allocator_ok);
+        tcase_add_test(tc_basic, test_lwc_table_round_trip);
+        tcase_add_test(tc_basic, test_lwc_intern_split);
+#ifdef LWC_UNICODE_FOLD
+        tcase_add_test(tc_basic, test_lwc_unicode_fold);
+#else
+        tcase_add_test(tc_basic, test_lwc_ascii_fold);
+#endif
+#ifdef LWC_WITH_SHM
+        tcase_add_test(tc_basic, test_lwc_shm_publish_attach);
+        tcase_add_test(tc_basic, test_lwc_shm_attach_invalid);
+        tcase_add_test(tc_basic, test_lwc_shm_attach_elsewhere);
+#else
+        tcase_add_test(tc_basic, test_lwc_shm_unsupported);
+#endif
+        tcase_add_test(tc_basic, test_lwc_freeze);
+#ifdef LWC_SPLIT_LAYOUT
+        tcase_add_test(tc_basic, test_lwc_split_layout);
+#endif
+#if LWC_USER_SLOTS > 0
+        tcase_add_test(tc_basic, test_lwc_user_data);
+#else
+        tcase_add_test(tc_basic, test_lwc_user_data_unsupported);
+#endif
+#ifdef LWC_WITH_RECORD
+        tcase_add_test(tc_basic, test_lwc_record_replay);
+        tcase_add_test(tc_basic, test_lwc_record_write_failed);
+#else
+        tcase_add_test(tc_basic, test_lwc_record_unsupported);
+#endif
+        tcase_add_test(tc_basic, test_lwc_replay_invalid);
         suite_add_tcase(s, tc_basic);
         
         tc_basic = tcase_create("Ops with a filled context");
@@ -467,15 +1819,25 @@ lwc_basic_suite(SRunner *sr)
         tcase_add_test(tc_basic, test_lwc_string_caseless_isequal_ok1);
         tcase_add_test(tc_basic, test_lwc_string_caseless_isequal_ok2);
         tcase_add_test(tc_basic, test_lwc_string_caseless_isequal_bad);
+        tcase_add_test(tc_basic, test_lwc_string_caseless_no_intern);
         tcase_add_test(tc_basic, test_lwc_string_tolower_ok1);
         tcase_add_test(tc_basic, test_lwc_string_tolower_ok2);
         tcase_add_test(tc_basic, test_lwc_extract_data_ok);
         tcase_add_test(tc_basic, test_lwc_string_hash_value_ok);
+        tcase_add_test(tc_basic, test_lwc_string_full_hash_value_ok);
         tcase_add_test(tc_basic, test_lwc_string_is_nul_terminated);
         tcase_add_test(tc_basic, test_lwc_substring_is_nul_terminated);
         tcase_add_test(tc_basic, test_lwc_intern_substring_bad_size);
         tcase_add_test(tc_basic, test_lwc_intern_substring_bad_offset);
         tcase_add_test(tc_basic, test_lwc_string_iteration);
+        tcase_add_test(tc_basic, test_lwc_prefix_iteration);
+        tcase_add_test(tc_basic, test_lwc_prefix_iteration_maintained);
+#ifdef LWC_WITH_TRACE
+        tcase_add_test(tc_basic, test_lwc_trace_callback);
+        tcase_add_test(tc_basic, test_lwc_trace_sampled);
+#else
+        tcase_add_test(tc_basic, test_lwc_trace_unsupported);
+#endif
         suite_add_tcase(s, tc_basic);
         
         srunner_add_suite(sr, s);
@@ -0,0 +1,168 @@
+/* test/cxxtests.cpp
+ *
+ * Check the C++ interface to libwapcaplet
+ *
+ * Built as C++17, and again as C++20 for the "..."_lwc literal and
+ * heterogeneous lookup in unordered containers.
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+#include <libwapcaplet/libwapcaplet.hpp>
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(cond) do {                                                \
+                checks++;                                               \
+                if (!(cond)) {                                          \
+                        std::fprintf(stderr, "%s:%d: %s\n",             \
+                                     __FILE__, __LINE__, #cond);        \
+                        failures++;                                     \
+                }                                                       \
+        } while (0)
+
+/* References held by this thread, which is every one in this program */
+static lwc_refcounter
+refs(const lwc::string &s)
+{
+        return lwc__state(s.get())->refcnt;
+}
+
+static void
+count_cb(lwc_string *str, void *pw)
+{
+        (void) str;
+        (*static_cast<int *>(pw))++;
+}
+
+static int
+strings(void)
+{
+        int n = 0;
+
+        lwc_iterate_strings(count_cb, &n);
+
+        return n;
+}
+
+static void
+test_copy_move(void)
+{
+        lwc::string a("hello");
+
+        CHECK(refs(a) == 1);
+        {
+                lwc::string b(a);
+                CHECK(b == a);
+                CHECK(refs(a) == 2);
+
+                lwc::string c(std::move(b));
+                CHECK(!b);
+                CHECK(c == a);
+                CHECK(refs(a) == 2);
+
+                lwc::string d;
+                d = c;
+                CHECK(refs(a) == 3);
+
+                d = std::move(c);
+                CHECK(!c);
+                CHECK(refs(a) == 2);
+
+                lwc::string e("hello");
+                CHECK(e == a);
+                CHECK(refs(a) == 3);
+
+                swap(d, e);
+                CHECK(refs(a) == 3);
+        }
+        CHECK(refs(a) == 1);
+
+        lwc_string *raw = a.release();
+        CHECK(!a);
+
+        lwc::string f = lwc::string::adopt(raw);
+        CHECK(refs(f) == 1);
+
+        lwc::string g = lwc::string::share(raw);
+        CHECK(refs(f) == 2);
+        CHECK(g == "hello");
+}
+
+static void
+test_lookup(void)
+{
+        std::unordered_set<lwc::string, lwc::hash, lwc::equal_to> set;
+        std::string_view span("span");
+        lwc::string div("div");
+        int before;
+
+        set.emplace("div");
+        set.emplace(span);
+        CHECK(set.size() == 2);
+        CHECK(refs(div) == 2);
+
+        /* Transparent lookup relies on these agreeing */
+        CHECK(lwc::hash()(div) == lwc::hash()(std::string_view("div")));
+        CHECK(std::hash<lwc::string>()(div) == lwc::hash()(div));
+        CHECK(lwc::equal_to()(div, std::string_view("div")));
+        CHECK(!lwc::equal_to()(std::string_view("span"), div));
+
+        CHECK(set.count(div) == 1);
+
+        /* Looking up views doesn't intern them */
+        before = strings();
+        CHECK(lwc::hash()(std::string_view("p")) ==
+              lwc_calculate_hash("p", 1));
+        CHECK(!lwc::equal_to()(div, std::string_view("p")));
+#if defined(__cpp_lib_generic_unordered_lookup)
+        CHECK(set.find(span) != set.end());
+        CHECK(*set.find(span) == span);
+        CHECK(set.find(std::string_view("p")) == set.end());
+        CHECK(set.contains(std::string_view("div")));
+#endif
+        CHECK(strings() == before);
+
+        set.clear();
+        CHECK(refs(div) == 1);
+}
+
+#if defined(__cpp_nontype_template_args) && \
+                (__cpp_nontype_template_args >= 201911L)
+static void
+test_literal(void)
+{
+        using namespace lwc::literals;
+        lwc::string div("div");
+
+        CHECK(&"div"_lwc == &"div"_lwc);
+        CHECK("div"_lwc == div);
+        CHECK("div"_lwc != "span"_lwc);
+        CHECK(refs(div) == 2);
+}
+#endif
+
+int
+main(void)
+{
+        test_copy_move();
+        test_lookup();
+#if defined(__cpp_nontype_template_args) && \
+                (__cpp_nontype_template_args >= 201911L)
+        test_literal();
+#endif
+
+        std::printf("C++%ld: %d checks, %d failed\n",
+                    static_cast<long>(__cplusplus / 100 % 100),
+                    checks, failures);
+
+        return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
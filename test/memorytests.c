@@ -0,0 +1,309 @@
+/* test/memorytests.c
+ *
+ * Memory footprint tests for the test suite for libwapcaplet
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tests.h"
+
+#ifndef UNUSED
+#define UNUSED(x) (void)(x)
+#endif
+
+/* How far a corpus may exceed its budget before it counts as a regression,
+ * in percent.  Override with -DLWC_MEMORY_SLACK=n. */
+#ifndef LWC_MEMORY_SLACK
+#define LWC_MEMORY_SLACK (3)
+#endif
+
+/* Budgets are for a 64 bit host, one for the plain layout of a string and
+ * one for each option which adds to every string on purpose.  Builds with
+ * more than one of those, or more than one user slot, are only reported. */
+enum {
+        LAYOUT_PLAIN,
+        LAYOUT_THREADS,
+        LAYOUT_SPLIT,
+        LAYOUT_HASH_64,
+        LAYOUT_RECORD,
+        LAYOUT_USER_SLOT,
+        MEMORY_LAYOUTS
+};
+
+static const char *const memory_layouts[MEMORY_LAYOUTS] = {
+        "plain", "threads", "split layout", "64 bit hashes", "recording",
+        "one user slot"
+};
+
+#if defined(LWC_WITH_THREADS) + defined(LWC_SPLIT_LAYOUT) + \
+        defined(LWC_HASH_64) + defined(LWC_WITH_RECORD) + \
+        (LWC_USER_SLOTS > 0) > 1 || LWC_USER_SLOTS > 1
+#define MEMORY_LAYOUT (-1)
+#elif defined(LWC_WITH_THREADS)
+#define MEMORY_LAYOUT LAYOUT_THREADS
+#elif defined(LWC_SPLIT_LAYOUT)
+#define MEMORY_LAYOUT LAYOUT_SPLIT
+#elif defined(LWC_HASH_64)
+#define MEMORY_LAYOUT LAYOUT_HASH_64
+#elif defined(LWC_WITH_RECORD)
+#define MEMORY_LAYOUT LAYOUT_RECORD
+#elif LWC_USER_SLOTS == 1
+#define MEMORY_LAYOUT LAYOUT_USER_SLOT
+#else
+#define MEMORY_LAYOUT LAYOUT_PLAIN
+#endif
+
+#define MEMORY_ENFORCE (MEMORY_LAYOUT >= 0 && sizeof(void *) == 8)
+
+/* Bytes allocated to each string besides its own, kept out of the table */
+#ifdef LWC_SPLIT_LAYOUT
+#define MEMORY_HEADER (sizeof(lwc_string) + sizeof(lwc_string_state))
+#else
+#define MEMORY_HEADER (sizeof(lwc_string))
+#endif
+
+/**** Counting allocator ****/
+
+/* What every live allocation costs, as asked for and as a typical malloc
+ * would spend on it */
+typedef struct memory_count_s {
+        size_t bytes;
+        size_t overhead;
+        size_t allocs;
+} memory_count;
+
+static memory_count live;
+
+/**
+ * Model what a typical malloc spends on an allocation besides the bytes
+ * asked for: a size word and rounding up to 16 bytes, 32 at least.
+ *
+ * A model rather than malloc_usable_size() so that budgets hold on any
+ * host libc.
+ */
+static size_t
+memory_overhead(size_t size)
+{
+        size_t chunk = (size + 8 + 15) & ~(size_t)15;
+
+        if (chunk < 32)
+                chunk = 32;
+
+        return chunk - size;
+}
+
+static void *
+memory_alloc(size_t size, void *pw)
+{
+        UNUSED(pw);
+        live.bytes += size;
+        live.overhead += memory_overhead(size);
+        live.allocs++;
+        return malloc(size);
+}
+
+static void
+memory_free(void *ptr, size_t size, void *pw)
+{
+        UNUSED(pw);
+        live.bytes -= size;
+        live.overhead -= memory_overhead(size);
+        live.allocs--;
+        free(ptr);
+}
+
+/**** Corpora ****/
+
+/* A corpus of distinct strings, made the same way on every run */
+typedef struct memory_corpus_s {
+        const char *name;
+        size_t count;
+        /** Write string \a i into \a buf, returning its length */
+        size_t (*make)(size_t i, char *buf);
+        /** Bytes per string for each layout */
+        double budget[MEMORY_LAYOUTS];
+} memory_corpus;
+
+static const char *const memory_words[] = {
+        "Color", "margin", "Font", "border", "width", "Height", "align",
+        "Display", "content", "Position", "overflow", "Padding", "radius",
+        "shadow", "Transform", "index"
+};
+
+static size_t
+memory_make_ident(size_t i, char *buf)
+{
+        return (size_t)sprintf(buf, "%s-%s-%zx",
+                        memory_words[i % 16], memory_words[(i / 16) % 16],
+                        i / 256);
+}
+
+static size_t
+memory_make_short(size_t i, char *buf)
+{
+        static const char digits[] = "abcdefghijklmnopqrstuvwxyz012345";
+        size_t len = 0;
+
+        /* Base 32, with every other string in capitals */
+        do {
+                buf[len] = digits[i % 32];
+                if ((i & 1) && buf[len] >= 'a')
+                        buf[len] -= 'a' - 'A';
+                len++;
+                i /= 32;
+        } while (i > 0);
+
+        buf[len] = '\0';
+
+        return len;
+}
+
+static size_t
+memory_make_url(size_t i, char *buf)
+{
+        return (size_t)sprintf(buf,
+                        "https://www.example.org/Assets/%08zx/Index.html", i);
+}
+
+/* Budgets by layout: plain, threads, split, 64 bit hashes, recording and
+ * one user slot */
+static const memory_corpus memory_identifiers = {
+        "identifiers", 4096, memory_make_ident,
+        { 143.0, 183.5, 157.0, 156.5, 156.5, 156.5 }
+};
+
+static const memory_corpus memory_short = {
+        "short", 4096, memory_make_short,
+        { 125.0, 183.5, 156.0, 154.0, 154.0, 154.0 }
+};
+
+static const memory_corpus memory_urls = {
+        "urls", 1024, memory_make_url,
+        { 256.0, 320.0, 288.5, 288.0, 288.0, 288.0 }
+};
+
+/**** Tests ****/
+
+static void
+memory_payload_cb(lwc_string *str, void *pw)
+{
+        size_t *counts = pw;
+
+        counts[0]++;
+        counts[1] += lwc_string_length(str) + 1;
+}
+
+static void
+memory_measure(const memory_corpus *corpus)
+{
+        lwc_string **strs = calloc(corpus->count, sizeof(lwc_string *));
+        lwc_string **lower = calloc(corpus->count, sizeof(lwc_string *));
+        size_t i, counts[2] = { 0, 0 }, header, payload, table;
+        memory_count interned, caseless;
+        double per, total, budget, limit;
+        char buf[64];
+
+        fail_unless(strs != NULL && lower != NULL);
+        fail_unless(lwc_set_allocator(memory_alloc, NULL, memory_free,
+                                      NULL) == lwc_error_ok,
+                    "Unable to set allocator");
+        memset(&live, 0, sizeof(live));
+
+        for (i = 0; i < corpus->count; i++) {
+                size_t len = corpus->make(i, buf);
+
+                fail_unless(lwc_intern_string(buf, len, &strs[i]) ==
+                            lwc_error_ok);
+        }
+
+        interned = live;
+        lwc_iterate_strings(memory_payload_cb, counts);
+        fail_unless(counts[0] == corpus->count,
+                    "Corpus strings weren't distinct");
+        payload = counts[1];
+
+        /* Caseless comparison of strings from different documents needs
+         * every string's lowercase form interned as well */
+        for (i = 0; i < corpus->count; i++)
+                fail_unless(lwc_string_tolower(strs[i], &lower[i]) ==
+                            lwc_error_ok);
+
+        caseless = live;
+
+        per = 1.0 / corpus->count;
+        header = corpus->count * MEMORY_HEADER;
+        table = interned.bytes - header - payload;
+        total = (caseless.bytes + caseless.overhead) * per;
+        budget = (MEMORY_LAYOUT >= 0) ? corpus->budget[MEMORY_LAYOUT] : 0;
+        limit = budget * (100 + LWC_MEMORY_SLACK) / 100;
+
+        printf("memory: %-11s %5zu strings, %6.1f bytes/string "
+               "(header %.1f, payload %.1f, overhead %.1f, "
+               "table %.1f, caseless %.1f), budget %.1f (%s)\n",
+               corpus->name, corpus->count, total,
+               header * per, payload * per, interned.overhead * per,
+               table * per,
+               (caseless.bytes + caseless.overhead -
+                interned.bytes - interned.overhead) * per,
+               budget, (MEMORY_LAYOUT >= 0) ?
+               memory_layouts[MEMORY_LAYOUT] : "none");
+
+        if (MEMORY_ENFORCE)
+                fail_unless(total <= limit,
+                            "Footprint of %s regressed: %.1f bytes/string, "
+                            "budget %.1f", corpus->name, total, budget);
+
+        for (i = 0; i < corpus->count; i++) {
+                lwc_string_unref(lower[i]);
+                lwc_string_unref(strs[i]);
+        }
+        (void) lwc_collect();
+
+        /* Releases the context as well */
+        fail_unless(lwc_set_allocator(NULL, NULL, NULL, NULL) ==
+                    lwc_error_ok);
+        fail_unless(live.allocs == 0, "Allocations were leaked");
+        fail_unless(live.bytes == 0, "Frees were given the wrong size");
+
+        free(lower);
+        free(strs);
+}
+
+START_TEST (test_lwc_memory_identifiers)
+{
+        memory_measure(&memory_identifiers);
+}
+END_TEST
+
+START_TEST (test_lwc_memory_short)
+{
+        memory_measure(&memory_short);
+}
+END_TEST
+
+START_TEST (test_lwc_memory_urls)
+{
+        memory_measure(&memory_urls);
+}
+END_TEST
+
+/**** And the suite is set up here ****/
+
+void
+lwc_memory_suite(SRunner *sr)
+{
+        Suite *s = suite_create("libwapcaplet: Memory footprint");
+        TCase *tc_memory = tcase_create("Corpora");
+
+        tcase_add_test(tc_memory, test_lwc_memory_identifiers);
+        tcase_add_test(tc_memory, test_lwc_memory_short);
+        tcase_add_test(tc_memory, test_lwc_memory_urls);
+        suite_add_tcase(s, tc_memory);
+
+        srunner_add_suite(sr, s);
+}
@@ -0,0 +1,178 @@
+/* test/replay.c
+ *
+ * Replay a trace recorded by lwc_record_start() and report what it cost
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libwapcaplet/libwapcaplet.h>
+
+#ifndef UNUSED
+#define UNUSED(x) (void)(x)
+#endif
+
+static const char *const replay_names[LWC_REPLAY_STATS_SIZE] = {
+        "intern", "substring", "ref", "unref", "caseless", "tolower", "total"
+};
+
+/* Bytes allocated through libwapcaplet, now and at most */
+static size_t replay_live, replay_peak;
+
+static void *
+replay_alloc(size_t size, void *pw)
+{
+        UNUSED(pw);
+        replay_live += size;
+        if (replay_live > replay_peak)
+                replay_peak = replay_live;
+        return malloc(size);
+}
+
+static void
+replay_free(void *ptr, size_t size, void *pw)
+{
+        UNUSED(pw);
+        replay_live -= size;
+        free(ptr);
+}
+
+/**
+ * Record a small trace of our own, for when no trace is given.
+ *
+ * \return A descriptor open on the trace, or -1 if recording isn't
+ *         built in.
+ */
+static int
+replay_record_sample(void)
+{
+        FILE *f = tmpfile();
+        lwc_string *strs[64], *lower;
+        char buf[32];
+        bool equal;
+        lwc_error err;
+        int i, fd;
+
+        if (f == NULL) {
+                perror("tmpfile");
+                exit(EXIT_FAILURE);
+        }
+
+        fd = dup(fileno(f));
+        fclose(f);
+
+        err = lwc_record_start(fd);
+        if (err == lwc_error_unsupported) {
+                close(fd);
+                return -1;
+        } else if (err != lwc_error_ok) {
+                fprintf(stderr, "Unable to record: %d\n", err);
+                exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < 4096; i++) {
+                lwc_string **str = &strs[i % 64];
+                int len = sprintf(buf, "Property-%d", i % 256);
+
+                if (i >= 64)
+                        lwc_string_unref(*str);
+
+                if (lwc_intern_string(buf, len, str) != lwc_error_ok ||
+                    lwc_string_tolower(*str, &lower) != lwc_error_ok ||
+                    lwc_string_caseless_isequal(*str, lower,
+                                                &equal) != lwc_error_ok) {
+                        fprintf(stderr, "Unable to intern\n");
+                        exit(EXIT_FAILURE);
+                }
+
+                lwc_string_unref(lower);
+        }
+
+        for (i = 0; i < 64; i++)
+                lwc_string_unref(strs[i]);
+
+        if (lwc_record_stop() != lwc_error_ok ||
+            lseek(fd, 0, SEEK_SET) != 0) {
+                fprintf(stderr, "Unable to write trace\n");
+                exit(EXIT_FAILURE);
+        }
+
+        return fd;
+}
+
+int
+main(int argc, char **argv)
+{
+        lwc_replay_stats stats[LWC_REPLAY_STATS_SIZE];
+        const lwc_replay_stats *total = &stats[lwc_replay_op_count];
+        lwc_error err;
+        int fd, i;
+
+        if (argc > 2) {
+                fprintf(stderr, "Usage: %s [TRACE]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        if (argc == 2) {
+                fd = open(argv[1], O_RDONLY);
+                if (fd < 0) {
+                        perror(argv[1]);
+                        return EXIT_FAILURE;
+                }
+        } else {
+                fd = replay_record_sample();
+                if (fd < 0) {
+                        printf("replay: recording not built in, "
+                               "nothing to replay\n");
+                        return EXIT_SUCCESS;
+                }
+        }
+
+        if (lwc_set_allocator(replay_alloc, NULL, replay_free, NULL) !=
+            lwc_error_ok) {
+                fprintf(stderr, "Unable to set allocator\n");
+                return EXIT_FAILURE;
+        }
+
+        err = lwc_replay(fd, stats);
+        close(fd);
+
+        (void) lwc_collect();
+        (void) lwc_set_allocator(NULL, NULL, NULL, NULL);
+
+        if (err != lwc_error_ok) {
+                fprintf(stderr, "Unable to replay: %d\n", err);
+                return EXIT_FAILURE;
+        }
+
+        printf("%-10s %10s %10s %8s %8s %8s %8s\n", "call", "calls",
+               "calls/s", "p50/ns", "p90/ns", "p99/ns", "max/ns");
+        for (i = 0; i < LWC_REPLAY_STATS_SIZE; i++) {
+                const lwc_replay_stats *s = &stats[i];
+
+                if (s->calls == 0)
+                        continue;
+
+                printf("%-10s %10llu %10.0f %8llu %8llu %8llu %8llu\n",
+                       replay_names[i], (unsigned long long)s->calls,
+                       s->elapsed ? s->calls * 1e9 / s->elapsed : 0.0,
+                       (unsigned long long)s->p50,
+                       (unsigned long long)s->p90,
+                       (unsigned long long)s->p99,
+                       (unsigned long long)s->max);
+        }
+        printf("peak memory %zu bytes over %llu calls\n", replay_peak,
+               (unsigned long long)total->calls);
+
+        if (replay_live != 0) {
+                fprintf(stderr, "%zu bytes left allocated\n", replay_live);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,412 @@
+/* test/scaling.c
+ *
+ * Measure how interning scales over threads, and where they contend
+ *
+ * Copyright 2026 The NetSurf Browser Project.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef LWC_WITH_THREADS
+#include <pthread.h>
+#endif
+
+#include <libwapcaplet/libwapcaplet.h>
+
+/* Bucketed as lwc_replay() does */
+#include "histogram.h"
+
+#define HOT_COUNT	(1024)		/* Strings held throughout */
+#define SHARED_COUNT	(8)		/* Hot strings every thread refs */
+#define CHURN_COUNT	(4096)		/* Strings nobody holds */
+#define MISS_RING	(256)		/* Unique strings each thread holds */
+#define MAX_THREADS	(256)
+
+typedef enum scaling_op_e {
+        OP_HIT,         /* Intern a string that is already interned */
+        OP_MISS,        /* Intern a string that never was, keep it a while */
+        OP_REF,         /* Ref and unref one of a few shared strings */
+        OP_CHURN,       /* Intern a string nobody holds, and release it */
+        OP_COUNT
+} scaling_op;
+
+static const char *const op_names[OP_COUNT] = { "hit", "miss", "ref", "churn" };
+
+/* A mix of operations, by weight */
+typedef struct scaling_mix_s {
+        const char *name;
+        unsigned int weight[OP_COUNT];
+} scaling_mix;
+
+static const scaling_mix presets[] = {
+        { "hit",   { 1, 0, 0, 0 } },
+        { "miss",  { 0, 1, 0, 0 } },
+        { "ref",   { 0, 0, 1, 0 } },
+        { "churn", { 0, 0, 0, 1 } },
+        { "mixed", { 70, 5, 20, 5 } }
+};
+
+#define PRESETS (sizeof(presets) / sizeof(presets[0]))
+
+static char hot_text[HOT_COUNT][24];
+static char churn_text[CHURN_COUNT][24];
+static lwc_string *hot[HOT_COUNT];
+
+typedef struct scaling_thread_s {
+        unsigned int id;
+        const scaling_mix *mix;
+        unsigned long ops;
+        uint64_t elapsed;
+        uint64_t max;
+        uint64_t hist[LWC_HISTOGRAM_BUCKETS];
+} scaling_thread;
+
+#ifdef LWC_WITH_THREADS
+static int start_flag;		/* Set once every thread has started */
+#endif
+
+static uint64_t
+scaling_now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64*, seeded per thread */
+static uint64_t
+scaling_random(uint64_t *state)
+{
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+
+        return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static void
+scaling_fail(const char *what)
+{
+        fprintf(stderr, "scaling: %s\n", what);
+        exit(EXIT_FAILURE);
+}
+
+static void *
+scaling_worker(void *pw)
+{
+        scaling_thread *t = pw;
+        lwc_string *ring[MISS_RING] = { NULL };
+        uint64_t state = 0x9e3779b97f4a7c15ULL * (t->id + 1);
+        unsigned int total = 0, i, miss = 0;
+        unsigned long n;
+        char text[32];
+
+        for (i = 0; i < OP_COUNT; i++)
+                total += t->mix->weight[i];
+
+#ifdef LWC_WITH_THREADS
+        while (__atomic_load_n(&start_flag, __ATOMIC_ACQUIRE) == 0)
+                ;
+#endif
+
+        for (n = 0; n < t->ops; n++) {
+                uint64_t r = scaling_random(&state), start, ns;
+                unsigned int pick = (unsigned int)(r >> 32) % total;
+                lwc_string *str, **slot = NULL;
+                size_t len = 0;
+                scaling_op op;
+
+                for (op = 0; pick >= t->mix->weight[op]; op++)
+                        pick -= t->mix->weight[op];
+
+                /* Prepare outside the timed part */
+                if (op == OP_MISS) {
+                        len = (size_t)sprintf(text, "miss-%u-%u", t->id,
+                                              miss);
+                        slot = &ring[miss++ % MISS_RING];
+                }
+
+                start = scaling_now();
+
+                switch (op) {
+                case OP_HIT:
+                        str = hot[r % HOT_COUNT];
+                        if (lwc_intern_string(lwc_string_data(str),
+                                              lwc_string_length(str),
+                                              &str) != lwc_error_ok)
+                                scaling_fail("intern failed");
+                        lwc_string_unref(str);
+                        break;
+                case OP_MISS:
+                        if (*slot != NULL)
+                                lwc_string_unref(*slot);
+                        if (lwc_intern_string(text, len, slot) !=
+                            lwc_error_ok)
+                                scaling_fail("intern failed");
+                        break;
+                case OP_REF:
+                        str = lwc_string_ref(hot[r % SHARED_COUNT]);
+                        lwc_string_unref(str);
+                        break;
+                case OP_CHURN:
+                        i = (unsigned int)(r % CHURN_COUNT);
+                        if (lwc_intern_string(churn_text[i],
+                                              strlen(churn_text[i]),
+                                              &str) != lwc_error_ok)
+                                scaling_fail("intern failed");
+                        lwc_string_unref(str);
+                        break;
+                default:
+                        break;
+                }
+
+                ns = scaling_now() - start;
+                t->elapsed += ns;
+                t->hist[lwc__histogram_bucket(ns)]++;
+                if (ns > t->max)
+                        t->max = ns;
+        }
+
+        for (i = 0; i < MISS_RING; i++) {
+                if (ring[i] != NULL)
+                        lwc_string_unref(ring[i]);
+        }
+
+        return NULL;
+}
+
+/**
+ * Run a mix on a number of threads.
+ *
+ * @return Operations per second over all threads.
+ */
+static double
+scaling_run(const scaling_mix *mix, unsigned int threads, unsigned long ops,
+            double base)
+{
+        static scaling_thread t[MAX_THREADS];
+        uint64_t hist[LWC_HISTOGRAM_BUCKETS], max = 0, worst = 0, start, wall;
+        unsigned int i, b;
+        double rate;
+#ifdef LWC_WITH_THREADS
+        pthread_t tid[MAX_THREADS];
+#endif
+
+        memset(t, 0, sizeof(t));
+        memset(hist, 0, sizeof(hist));
+        for (i = 0; i < threads; i++) {
+                t[i].id = i;
+                t[i].mix = mix;
+                t[i].ops = ops;
+        }
+
+#ifdef LWC_WITH_THREADS
+        __atomic_store_n(&start_flag, 0, __ATOMIC_RELEASE);
+        for (i = 0; i < threads; i++) {
+                if (pthread_create(&tid[i], NULL, scaling_worker,
+                                   &t[i]) != 0)
+                        scaling_fail("unable to start thread");
+        }
+
+        start = scaling_now();
+        __atomic_store_n(&start_flag, 1, __ATOMIC_RELEASE);
+        for (i = 0; i < threads; i++)
+                pthread_join(tid[i], NULL);
+#else
+        start = scaling_now();
+        scaling_worker(&t[0]);
+#endif
+        wall = scaling_now() - start;
+
+        for (i = 0; i < threads; i++) {
+                uint64_t p99 = lwc__histogram_percentile(t[i].hist,
+                                                         t[i].max, 99);
+
+                for (b = 0; b < LWC_HISTOGRAM_BUCKETS; b++)
+                        hist[b] += t[i].hist[b];
+                if (t[i].max > max)
+                        max = t[i].max;
+                if (p99 > worst)
+                        worst = p99;
+        }
+
+        rate = (double)ops * threads * 1e9 / (wall > 0 ? wall : 1);
+
+        printf("%-8s %7u %10.2f %7.2fx %7llu %7llu %9llu %10llu\n",
+               mix->name, threads, rate / 1e6,
+               base > 0 ? rate / base : 1.0,
+               (unsigned long long)lwc__histogram_percentile(hist, max, 50),
+               (unsigned long long)lwc__histogram_percentile(hist, max, 99),
+               (unsigned long long)max,
+               (unsigned long long)worst);
+
+        return rate;
+}
+
+static void
+scaling_usage(const char *name)
+{
+        size_t i;
+
+        fprintf(stderr, "Usage: %s [-t THREADS] [-n OPS] [-m MIX]...\n"
+                "  THREADS  most threads to run, in powers of two "
+                "(default: cores, at most 4)\n"
+                "  OPS      operations per thread (default: 20000)\n"
+                "  MIX      a preset, or hit=W,miss=W,ref=W,churn=W\n"
+                "  presets:", name);
+        for (i = 0; i < PRESETS; i++)
+                fprintf(stderr, " %s", presets[i].name);
+        fprintf(stderr, "\n");
+        exit(EXIT_FAILURE);
+}
+
+/**
+ * Parse a mix given on the command line.
+ */
+static bool
+scaling_parse_mix(const char *arg, scaling_mix *mix)
+{
+        const char *p = arg;
+        size_t i;
+
+        for (i = 0; i < PRESETS; i++) {
+                if (strcmp(arg, presets[i].name) == 0) {
+                        *mix = presets[i];
+                        return true;
+                }
+        }
+
+        memset(mix, 0, sizeof(*mix));
+        mix->name = "custom";
+
+        while (*p != '\0') {
+                scaling_op op;
+                char *end;
+
+                for (op = 0; op < OP_COUNT; op++) {
+                        size_t len = strlen(op_names[op]);
+
+                        if (strncmp(p, op_names[op], len) == 0 &&
+                            p[len] == '=')
+                                break;
+                }
+                if (op == OP_COUNT)
+                        return false;
+
+                p += strlen(op_names[op]) + 1;
+                mix->weight[op] = (unsigned int)strtoul(p, &end, 10);
+                if (end == p || (*end != ',' && *end != '\0'))
+                        return false;
+                p = (*end == ',') ? end + 1 : end;
+        }
+
+        return mix->weight[OP_HIT] + mix->weight[OP_MISS] +
+                        mix->weight[OP_REF] + mix->weight[OP_CHURN] > 0;
+}
+
+static void
+scaling_count_cb(lwc_string *str, void *pw)
+{
+        (void) str;
+        *((size_t *)pw) += 1;
+}
+
+int
+main(int argc, char **argv)
+{
+        scaling_mix mixes[16];
+        unsigned int most = 0, threads, i;
+        unsigned long ops = 20000;
+        size_t nmixes = 0, left = 0;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "t:n:m:")) != -1) {
+                switch (opt) {
+                case 't':
+                        most = (unsigned int)strtoul(optarg, NULL, 10);
+                        if (most == 0 || most > MAX_THREADS)
+                                scaling_usage(argv[0]);
+                        break;
+                case 'n':
+                        ops = strtoul(optarg, NULL, 10);
+                        if (ops == 0)
+                                scaling_usage(argv[0]);
+                        break;
+                case 'm':
+                        if (nmixes == sizeof(mixes) / sizeof(mixes[0]) ||
+                            scaling_parse_mix(optarg,
+                                              &mixes[nmixes++]) == false)
+                                scaling_usage(argv[0]);
+                        break;
+                default:
+                        scaling_usage(argv[0]);
+                }
+        }
+
+        if (optind != argc)
+                scaling_usage(argv[0]);
+
+        if (nmixes == 0) {
+                for (nmixes = 0; nmixes < PRESETS; nmixes++)
+                        mixes[nmixes] = presets[nmixes];
+        }
+
+#ifdef LWC_WITH_THREADS
+        if (most == 0) {
+                long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+                most = (cores < 1) ? 1 : (cores > 4) ? 4 : (unsigned int)cores;
+        }
+#else
+        if (most > 1)
+                fprintf(stderr, "scaling: threads not built in, "
+                        "running one\n");
+        most = 1;
+#endif
+
+        for (i = 0; i < HOT_COUNT; i++) {
+                size_t len = (size_t)sprintf(hot_text[i], "Hot-%u", i);
+
+                if (lwc_intern_string(hot_text[i], len, &hot[i]) !=
+                    lwc_error_ok)
+                        scaling_fail("intern failed");
+        }
+        for (i = 0; i < CHURN_COUNT; i++)
+                sprintf(churn_text[i], "churn-%u", i);
+
+        printf("%-8s %7s %10s %8s %7s %7s %9s %10s\n", "mix", "threads",
+               "Mops/s", "scaling", "p50/ns", "p99/ns", "max/ns",
+               "worst p99");
+
+        for (i = 0; i < nmixes; i++) {
+                double base = 0;
+
+                /* Powers of two, and then the most asked for */
+                for (threads = 1; threads <= most;
+                     threads = (threads < most && threads * 2 > most) ?
+                             most : threads * 2) {
+                        double rate = scaling_run(&mixes[i], threads, ops,
+                                                  base);
+
+                        if (threads == 1)
+                                base = rate;
+                }
+        }
+
+        for (i = 0; i < HOT_COUNT; i++)
+                lwc_string_unref(hot[i]);
+
+        (void) lwc_collect();
+        lwc_iterate_strings(scaling_count_cb, &left);
+        if (left != 0) {
+                fprintf(stderr, "scaling: %zu strings leaked\n", left);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}